@@ -1,5 +1,6 @@
 rm -f build/unittest
 rm -f build/stt
+rm -f build/bench
 
 cmake -S . -B build
 cmake --build build -j 40
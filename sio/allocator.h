@@ -1,6 +1,8 @@
 #ifndef SIO_ALLOCATOR_H
 #define SIO_ALLOCATOR_H
 
+#include <algorithm>
+
 #include "sio/ptr.h"
 #include "sio/check.h"
 #include "sio/vec.h"
@@ -41,10 +43,11 @@ public:
             Vec<char>& s = slabs_.back();
             s.resize(size0_ * size1_ * sizeof(T));
 
-            char* p = s.data();
+            // pushed in reverse, so allocations are popped in address order
+            char* p = s.data() + size0_ * size1_ * sizeof(T);
             for (int i = 0; i < size0_; i++) {
+                p -= size1_ * sizeof(T);
                 FreeListPush((FreeNode*)p);
-                p += size1_ * sizeof(T);
             }
         }
 
@@ -61,6 +64,7 @@ public:
 
     size_t NumUsed() const { return num_used_; }
     size_t NumFree() const { return num_free_; }
+    size_t NumSlabs() const { return slabs_.size(); }  // in use or idle, see ResetRetainCapacity()
 
 
     void Reset() {
@@ -71,6 +75,28 @@ public:
         num_free_ = 0;
     }
 
+
+    // Frees all allocations but keeps at most max_slabs slabs (high-water cap) for reuse,
+    // so a long-lived allocator reaches steady state without malloc & page faults.
+    void ResetRetainCapacity(size_t max_slabs) {
+        if (slabs_.size() > max_slabs) {
+            slabs_.resize(max_slabs);
+        }
+
+        free_list_ = nullptr;
+        num_used_ = 0;
+        num_free_ = 0;
+
+        // same order as slab growth in Alloc()
+        for (auto s = slabs_.rbegin(); s != slabs_.rend(); ++s) {
+            char* p = s->data() + size0_ * size1_ * sizeof(T);
+            for (int i = 0; i < size0_; i++) {
+                p -= size1_ * sizeof(T);
+                FreeListPush((FreeNode*)p);
+            }
+        }
+    }
+
 private:
 
     inline void FreeListPush(FreeNode* p) {
@@ -89,5 +115,76 @@ private:
     }
 
 }; // class SlabAllocator
+
+
+// A view of contiguous elements [begin, end), no ownership
+template <typename T>
+class Span {
+    T* data_ = nullptr;
+    size_t size_ = 0;
+
+public:
+    Span() = default;
+    Span(T* data, size_t size) : data_(data), size_(size) { }
+
+    T* begin() const { return data_; }
+    T* end() const { return data_ + size_; }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    T& operator[](size_t i) const { return data_[i]; }
+    T& front() const { return data_[0]; }
+    T& back() const { return data_[size_ - 1]; }
+};
+
+
+/*
+ * Append-only arena of trivially copyable elements:
+ *   1. each Append() copies a batch of elements into one chunk contiguously, and returns its Span.
+ *   2. chunks are reserved up front and never reallocated, so earlier Spans stay valid.
+ *   3. Reset() invalidates all Spans but retains chunks for reuse.
+ */
+template <typename T>
+class ChunkedArena {
+    size_t chunk_size_ = 4096;  // num of elements per chunk, larger batches get a dedicated chunk
+    Vec<Vec<T>> chunks_;
+    size_t cur_ = 0;  // chunks_[0, cur_) are full
+
+public:
+
+    void SetChunkSize(size_t chunk_size) {
+        SIO_CHECK_GE(chunk_size, 1);
+        chunk_size_ = chunk_size;
+    }
+
+
+    Span<T> Append(const T* data, size_t n) {
+        while (cur_ != chunks_.size() && chunks_[cur_].size() + n > chunks_[cur_].capacity()) {
+            cur_++;
+        }
+        if (cur_ == chunks_.size()) {
+            chunks_.emplace_back();
+            chunks_.back().reserve(std::max(chunk_size_, n));
+        }
+
+        Vec<T>& c = chunks_[cur_];
+        T* p = c.data() + c.size();
+        c.insert(c.end(), data, data + n); // fits in capacity, no reallocation
+        return Span<T>(p, n);
+    }
+
+
+    void Reset() {
+        for (Vec<T>& c : chunks_) {
+            c.clear();
+        }
+        cur_ = 0;
+    }
+
+
+    size_t NumChunks() const { return chunks_.size(); }
+
+}; // class ChunkedArena
 } // namespace sio
 #endif
@@ -52,4 +52,72 @@ TEST(Allocator, SlabAllocator) {
     // pool cleanup itself on destruction
 }
 
+TEST(Allocator, ResetRetainCapacity) {
+    SlabAllocator<void*> pool;
+    pool.SetSlabSize(4);
+
+    Vec<void**> ptrs;
+    for (int i = 0; i != 10; i++) {
+        ptrs.push_back(pool.Alloc());
+    }
+    EXPECT_EQ(pool.NumSlabs(), 3);
+
+    // keeps all slabs, every allocation is free again
+    pool.ResetRetainCapacity(8);
+    EXPECT_EQ(pool.NumSlabs(), 3);
+    EXPECT_EQ(pool.NumUsed(), 0);
+    EXPECT_EQ(pool.NumFree(), 12);
+
+    // steady state: same addresses in same order, without slab growth
+    for (int i = 0; i != 10; i++) {
+        EXPECT_EQ(pool.Alloc(), ptrs[i]);
+    }
+    EXPECT_EQ(pool.NumSlabs(), 3);
+
+    // high-water cap
+    pool.ResetRetainCapacity(1);
+    EXPECT_EQ(pool.NumSlabs(), 1);
+    EXPECT_EQ(pool.NumFree(), 4);
+    for (int i = 0; i != 5; i++) {
+        pool.Alloc();
+    }
+    EXPECT_EQ(pool.NumSlabs(), 2);
+
+    pool.ResetRetainCapacity(0);
+    EXPECT_EQ(pool.NumSlabs(), 0);
+    EXPECT_EQ(pool.NumFree(), 0);
+}
+
+TEST(Allocator, ChunkedArena) {
+    ChunkedArena<int> arena;
+    arena.SetChunkSize(4);
+
+    Vec<int> x = {1, 2, 3};
+    Span<int> a = arena.Append(x.data(), 3);
+    Span<int> b = arena.Append(x.data(), 2); // doesn't fit into 1st chunk
+    Span<int> c = arena.Append(x.data(), 1);
+    EXPECT_EQ(arena.NumChunks(), 2);
+    EXPECT_EQ(c.begin(), b.end()); // append-only, 1st chunk is done
+
+    Vec<int> big(10, 7);
+    Span<int> d = arena.Append(big.data(), big.size()); // dedicated chunk
+    EXPECT_EQ(arena.NumChunks(), 3);
+
+    // earlier spans stay valid
+    EXPECT_EQ(Vec<int>(a.begin(), a.end()), Vec<int>({1, 2, 3}));
+    EXPECT_EQ(Vec<int>(b.begin(), b.end()), Vec<int>({1, 2}));
+    EXPECT_EQ(c.size(), 1);
+    EXPECT_EQ(c[0], 1);
+    EXPECT_EQ(d.back(), 7);
+
+    // chunks are retained & reused
+    arena.Reset();
+    Span<int> e = arena.Append(x.data(), 3);
+    EXPECT_EQ(e.begin(), a.begin());
+    EXPECT_EQ(arena.NumChunks(), 3);
+
+    Span<int> empty = arena.Append(x.data(), 0);
+    EXPECT_TRUE(empty.empty());
+}
+
 } // namespace sio
@@ -10,6 +10,7 @@
 #include "sio/str.h"
 #include "sio/vec.h"
 #include "sio/map.h"
+#include "sio/set.h"
 #include "sio/util.h"
 #include "sio/math.h"
 #include "sio/dbg.h"
@@ -0,0 +1,341 @@
+#ifndef SIO_BATCH_SCORER_H
+#define SIO_BATCH_SCORER_H
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <deque>
+
+#include "torch/script.h"
+#include "torch/torch.h"
+
+#include "sio/base.h"
+#include "sio/struct_loader.h"
+#include "sio/histogram.h"
+#include "sio/latency_stats.h"
+
+namespace sio {
+
+struct BatchScorerConfig {
+    int max_batch_size = 1;  // <= 1: batching disabled, each session runs its own nnet forward
+    f32 max_wait_ms = 2.0;  // how long the oldest pending chunk may wait for others to join its batch
+
+    Error Register(StructLoader* loader, const std::string module = "") {
+        loader->AddEntry(module + ".max_batch_size", &max_batch_size);
+        loader->AddEntry(module + ".max_wait_ms", &max_wait_ms);
+        return Error::OK;
+    }
+};
+
+
+// One encoder chunk of a session, caches are replaced by next caches after forward, see Scorer::Advance()
+struct EncoderChunk {
+    torch::Tensor feat;  // [1, frames, idim]
+    i64 offset = 0;  // subsampled frames before this chunk
+    int required_cache_size = -1;
+    torch::jit::IValue subsampling_cache;  // [1, cache_frames, dim] or None
+    torch::jit::IValue elayers_output_cache;  // per layer [1, cache_frames, dim] or None
+    torch::jit::IValue conformer_cnn_cache;  // per layer [1, dim, kernel - 1] or None
+
+    torch::Tensor scores;  // output: [subsampled frames, odim]
+    f32 encoder_forward_ms = 0.0;  // output: of the whole batch this chunk went through
+    f32 ctc_activation_ms = 0.0;
+
+
+    // chunks of equal batch keys can be stacked along batch dim:
+    // exported forward_encoder_chunk takes a single offset and no masks, so neither offsets nor lengths can differ,
+    // padded frames or cache frames would be attended to as real ones.
+    std::tuple<i64, i64, i64, int> BatchKey() const {
+        i64 cache_frames = subsampling_cache.isTensor() ? subsampling_cache.toTensor().size(1) : 0;
+        return std::make_tuple(offset, feat.size(1), cache_frames, required_cache_size);
+    }
+};
+
+
+// Encoder forward & ctc activation of chunks sharing one BatchKey(), in one nnet call
+inline Error ForwardEncoderChunks(torch::jit::script::Module& nnet, const Vec<EncoderChunk*>& chunks) {
+    SIO_CHECK(!chunks.empty());
+    torch::NoGradGuard no_grad;
+    const EncoderChunk& first = *chunks[0];
+    const int batch = chunks.size();
+
+    // stack tensors (or per-layer tensor lists) of all chunks along batch dim
+    auto stack_tensor = [&](torch::jit::IValue EncoderChunk::* field) -> torch::jit::IValue {
+        if ((first.*field).isNone() || batch == 1) {
+            return first.*field;
+        }
+        Vec<torch::Tensor> xs;
+        for (const EncoderChunk* c : chunks) {
+            xs.push_back((c->*field).toTensor());
+        }
+        return torch::cat(xs, 0);
+    };
+    auto stack_list = [&](torch::jit::IValue EncoderChunk::* field) -> torch::jit::IValue {
+        if ((first.*field).isNone() || batch == 1) {
+            return first.*field;
+        }
+        Vec<torch::Tensor> layers = (first.*field).toTensorVector();
+        for (int l = 0; l != layers.size(); l++) {
+            Vec<torch::Tensor> xs;
+            for (const EncoderChunk* c : chunks) {
+                xs.push_back((c->*field).toTensorVector()[l]);
+            }
+            layers[l] = torch::cat(xs, 0);
+        }
+        return layers;
+    };
+
+    torch::Tensor feat = first.feat;
+    if (batch > 1) {
+        Vec<torch::Tensor> xs;
+        for (const EncoderChunk* c : chunks) {
+            xs.push_back(c->feat);
+        }
+        feat = torch::cat(xs, 0);
+    }
+
+    Vec<torch::jit::IValue> input = {
+        feat,
+        first.offset,
+        first.required_cache_size,
+        stack_tensor(&EncoderChunk::subsampling_cache),
+        stack_list(&EncoderChunk::elayers_output_cache),
+        stack_list(&EncoderChunk::conformer_cnn_cache)
+    };
+    auto forward_begin = std::chrono::steady_clock::now();
+    auto r = nnet.get_method("forward_encoder_chunk")(input).toTuple()->elements();
+    SIO_CHECK_EQ(r.size(), 4);
+    f32 encoder_forward_ms = ElapsedMs(forward_begin);
+
+    // [batch, frames, odim]
+    auto activation_begin = std::chrono::steady_clock::now();
+    torch::Tensor scores = nnet.run_method("ctc_activation", r[0].toTensor()).toTensor();
+    f32 ctc_activation_ms = ElapsedMs(activation_begin);
+    for (EncoderChunk* c : chunks) {
+        c->encoder_forward_ms = encoder_forward_ms;
+        c->ctc_activation_ms = ctc_activation_ms;
+    }
+
+    if (batch == 1) {
+        EncoderChunk* c = chunks[0];
+        c->scores = scores[0];
+        c->subsampling_cache = r[1];
+        c->elayers_output_cache = r[2];
+        c->conformer_cnn_cache = r[3];
+        return Error::OK;
+    }
+
+    // split outputs back to chunks, cloned so that sessions don't share (& pin down) batched storages
+    torch::Tensor subsampling_cache = r[1].toTensor();
+    Vec<torch::Tensor> elayers_output_cache = r[2].toTensorVector();
+    Vec<torch::Tensor> conformer_cnn_cache = r[3].toTensorVector();
+    for (int b = 0; b != batch; b++) {
+        auto slice = [b](Vec<torch::Tensor> layers) {
+            for (torch::Tensor& x : layers) {
+                x = x.narrow(0, b, 1).clone();
+            }
+            return layers;
+        };
+        EncoderChunk* c = chunks[b];
+        c->scores = scores[b];
+        c->subsampling_cache = subsampling_cache.narrow(0, b, 1).clone();
+        c->elayers_output_cache = slice(elayers_output_cache);
+        c->conformer_cnn_cache = slice(conformer_cnn_cache);
+    }
+
+    return Error::OK;
+}
+
+
+struct BatchScorerStats {
+    i64 num_batches = 0;  // nnet forward calls
+    i64 num_chunks = 0;
+
+    Histogram batch_size = Histogram::Linear(0.0, 64.0, 64);
+    Histogram queue_wait_ms = Histogram::Exponential(0.0625, 1.5, 24);  // chunk submitted -> forward begins
+
+
+    Str Report() const {
+        auto summary = [](const char* name, const Histogram& h) {
+            return absl::StrFormat("  %-20s mean:%10.2f  p50:%10.2f  p90:%10.2f  p99:%10.2f  max:%10.2f\n",
+                name, h.Mean(), h.Quantile(0.5), h.Quantile(0.9), h.Quantile(0.99), h.Max()
+            );
+        };
+
+        Str r = absl::StrFormat("batches:%d chunks:%d\n", num_batches, num_chunks);
+        r += summary("batch_size", batch_size);
+        r += summary("queue_wait_ms", queue_wait_ms);
+        return r;
+    }
+};
+
+
+/*
+ * BatchScorer is a shared nnet worker thread, batching encoder chunks of many concurrent sessions:
+ *   1. sessions submit ready chunks via Forward(), which blocks until outputs are dispatched back.
+ *   2. a batch is formed when max_batch_size chunks are pending, or the oldest one has waited max_wait_ms.
+ *   3. pending chunks are grouped by EncoderChunk::BatchKey(), one nnet forward per group,
+ *      so only sessions at the same chunk index are actually batched, e.g. sessions started within
+ *      max_wait_ms of each other. Chunks aren't padded to a common key, since the exported encoder
+ *      takes no per-row offsets or masks.
+ */
+class BatchScorer {
+    using Clock = std::chrono::steady_clock;
+
+    struct Request {
+        EncoderChunk* chunk;
+        Clock::time_point submitted;
+        std::promise<void> done;
+    };
+
+    BatchScorerConfig config_;
+    torch::jit::script::Module* nnet_ = nullptr;
+
+    std::thread worker_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<Request*> pending_;
+    bool stop_ = false;
+
+    std::mutex stats_mutex_;
+    BatchScorerStats stats_;
+
+public:
+
+    Error Load(const BatchScorerConfig& config, torch::jit::script::Module& nnet) {
+        SIO_CHECK(nnet_ == nullptr); // Can't reload
+        SIO_CHECK_GT(config.max_batch_size, 0);
+        config_ = config;
+        nnet_ = &nnet;
+
+        worker_ = std::thread([this]() { WorkerLoop(); });
+        return Error::OK;
+    }
+
+
+    ~BatchScorer() {
+        if (!worker_.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cond_.notify_all();
+        worker_.join();
+    }
+
+
+    // Blocks until *chunk is forwarded, thread-safe
+    Error Forward(EncoderChunk* chunk) {
+        Request req;
+        req.chunk = chunk;
+        req.submitted = Clock::now();
+        std::future<void> done = req.done.get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            SIO_CHECK(!stop_);
+            pending_.push_back(&req);
+        }
+        cond_.notify_one();
+        done.get(); // rethrows nnet errors
+        return Error::OK;
+    }
+
+
+    BatchScorerStats Stats() {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        return stats_;
+    }
+
+
+    void ResetStats() {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_ = BatchScorerStats();
+    }
+
+private:
+
+    void WorkerLoop() {
+        at::init_num_threads(); // this thread's share of process-wide intra-op budget
+        const auto max_wait = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<f32, std::milli>(config_.max_wait_ms)
+        );
+
+        while (true) {
+            Vec<Request*> batch;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_.wait(lock, [this]() { return stop_ || !pending_.empty(); });
+                if (pending_.empty()) {
+                    return; // stopped & drained
+                }
+                cond_.wait_until(lock, pending_.front()->submitted + max_wait, [this]() {
+                    return stop_ || pending_.size() >= config_.max_batch_size;
+                });
+                while (!pending_.empty() && batch.size() < config_.max_batch_size) {
+                    batch.push_back(pending_.front());
+                    pending_.pop_front();
+                }
+            }
+            ForwardBatch(batch);
+        }
+    }
+
+
+    void ForwardBatch(const Vec<Request*>& batch) {
+        Clock::time_point begin = Clock::now();
+
+        // group by batch key, in order of submission
+        Vec<Vec<Request*>> groups;
+        for (Request* req : batch) {
+            auto key = req->chunk->BatchKey();
+            auto it = std::find_if(groups.begin(), groups.end(), [&](const Vec<Request*>& g) {
+                return g[0]->chunk->BatchKey() == key;
+            });
+            if (it == groups.end()) {
+                groups.push_back({req});
+            } else {
+                it->push_back(req);
+            }
+        }
+
+        for (const Vec<Request*>& group : groups) {
+            Vec<EncoderChunk*> chunks;
+            for (Request* req : group) {
+                chunks.push_back(req->chunk);
+            }
+
+            std::exception_ptr error;
+            try {
+                ForwardEncoderChunks(*nnet_, chunks);
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(stats_mutex_);
+                stats_.num_batches++;
+                stats_.num_chunks += group.size();
+                stats_.batch_size.Add(group.size());
+                for (Request* req : group) {
+                    stats_.queue_wait_ms.Add(std::chrono::duration<f32, std::milli>(begin - req->submitted).count());
+                }
+            }
+
+            for (Request* req : group) { // req is owned by its submitter, not to be touched after this
+                if (error) {
+                    req->done.set_exception(error);
+                } else {
+                    req->done.set_value();
+                }
+            }
+        }
+    }
+
+}; // class BatchScorer
+} // namespace sio
+#endif
@@ -0,0 +1,225 @@
+#ifndef SIO_BATCH_SEARCH_H
+#define SIO_BATCH_SEARCH_H
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+
+#include "torch/torch.h"
+
+#include "sio/base.h"
+#include "sio/latency_stats.h"
+#include "sio/tokenizer.h"
+#include "sio/finite_state_machine.h"
+#include "sio/search.h"
+
+namespace sio {
+/*
+ * BatchBeamSearch advances many independent search sessions with one [batch, vocab] score matrix.
+ *   1. sessions share one decoding graph & tokenizer, each keeps its own frontier, lattice,
+ *      token set arena & token allocator, so sessions can begin & end independently.
+ *   2. emitting expansion is shared: source TokenSets of all sessions are grouped by graph state,
+ *      and each state's emitting arcs are visited once for the whole group, instead of once per TokenSet.
+ *      Each source TokenSet is a shard of BeamSearch::FrontierExpandEmittingParallel(), whose per-shard passes
+ *      are order independent, so results are exactly those of pushing each session on its own.
+ *   3. sessions whose frame can't be split this way (blank skipped frames, label pre-pruning, stateful LMs,
+ *      negative insertion penalty) expand on their own within the same Push().
+ * CPU time of adaptive_frame_budget_ms covers the whole batch, as it is all spent by the pushing thread.
+ */
+template <int MaxLms = 1>
+class BatchBeamSearch {
+    using Search = BeamSearch<MaxLms>;
+
+    struct Source {  // source TokenSet of shared emitting expansion
+        const Fsm* graph;
+        FsmStateId state;
+        int session;  // index of sessions_
+        int g;  // index of the session's graphs_
+        int k;  // index of the session's lattice_.back()
+    };
+
+    Vec<Unique<Search*>> sessions_;
+
+    // current Push(), indexed by session
+    Vec<const f32*> frame_scores_;
+    Vec<f32> score_offsets_;
+    Vec<f32> emitting_ms_;
+
+    Vec<int> shared_;  // sessions in shared emitting expansion
+    Vec<Source> sources_;  // sorted by graph state
+
+public:
+
+    Error Load(const BeamSearchConfig& config, const Fsm& graph, const Tokenizer& tokenizer, int max_batch_size) {
+        SIO_CHECK(sessions_.empty()); // Can't reload
+        SIO_CHECK_GT(max_batch_size, 0);
+
+        for (int s = 0; s != max_batch_size; s++) {
+            sessions_.push_back(std::make_unique<Search>());
+            sessions_.back()->Load(config, graph, tokenizer);
+        }
+        frame_scores_.resize(max_batch_size, nullptr);
+        score_offsets_.resize(max_batch_size, 0.0);
+        emitting_ms_.resize(max_batch_size, 0.0);
+
+        return Error::OK;
+    }
+
+
+    // score: [batch, vocab], row b is the next frame of session sessions[b]
+    Error Push(const torch::Tensor score, const Vec<int>& sessions) {
+        SIO_CHECK_EQ(score.dim(), 2);
+        SIO_CHECK_EQ(score.size(0), sessions.size());
+        SIO_CHECK(score.is_contiguous());
+        return Push(score.data_ptr<float>(), score.size(1), sessions);
+    }
+
+
+    // score: row b of stride floats is the next frame of session sessions[b]
+    Error Push(const f32* score, size_t stride, const Vec<int>& sessions) {
+        shared_.clear();
+        for (int b = 0; b != sessions.size(); b++) {
+            int s = sessions[b];
+            Search& search = Session(s);
+            SIO_CHECK(frame_scores_[s] == nullptr); // each session once per batch
+            frame_scores_[s] = score + b * stride;
+
+            search.BeginFrame();
+            if (!search.BlankSkipped(frame_scores_[s]) && !search.SelectsLabels() && search.SplittableExpansion()) {
+                shared_.push_back(s);
+            } else {
+                auto emitting_begin = std::chrono::steady_clock::now();
+                search.FrontierExpandEmitting(frame_scores_[s]);
+                emitting_ms_[s] = ElapsedMs(emitting_begin);
+            }
+        }
+
+        if (!shared_.empty()) {
+            auto emitting_begin = std::chrono::steady_clock::now();
+            FrontierExpandEmittingShared();
+            f32 ms = ElapsedMs(emitting_begin) / shared_.size();
+            for (int s : shared_) {
+                emitting_ms_[s] = ms;
+            }
+        }
+
+        for (int s : sessions) {
+            sessions_[s]->EndFrame(emitting_ms_[s]);
+            frame_scores_[s] = nullptr;
+        }
+
+        return Error::OK;
+    }
+
+
+    Error PushEos(int session) {
+        return Session(session).PushEos();
+    }
+
+
+    const Vec<Vec<TokenId>>& NBest(int session) {
+        return Session(session).NBest();
+    }
+
+
+    const Vec<TokenId>& PartialResult(int session) {
+        return Session(session).PartialResult();
+    }
+
+
+    Error Reset(int session) {
+        return Session(session).Reset();
+    }
+
+
+    size_t Size() const {
+        return sessions_.size();
+    }
+
+
+    // for per-session setups & stats, e.g. AddLm(), SetSubgraph(), Stats()
+    inline Search& Session(int session) {
+        SIO_CHECK(session >= 0 && session < sessions_.size());
+        return *sessions_[session];
+    }
+
+private:
+
+    // Emitting expansion of sessions in shared_, see class comment
+    void FrontierExpandEmittingShared() {
+        sources_.clear();
+        for (int s : shared_) {
+            Search& search = *sessions_[s];
+            score_offsets_[s] = search.BeginEmitting();
+
+            const auto& srcs = search.lattice_.back();
+            if (search.shards_.size() < srcs.size()) {
+                search.shards_.resize(srcs.size());
+            }
+            for (int k = 0; k != srcs.size(); k++) {
+                int g = search.instances_[HandleToGraph(srcs[k].handle)].graph;
+                sources_.push_back({search.graphs_[g], HandleToState(srcs[k].handle), s, g, k});
+            }
+        }
+        std::sort(sources_.begin(), sources_.end(), [](const Source& x, const Source& y) {
+            if (x.state != y.state) {
+                return x.state < y.state;
+            }
+            return std::less<const Fsm*>()(x.graph, y.graph);
+        });
+
+        ExpandSources(false);
+        for (int s : shared_) {  // replay in each session's serial order
+            Search& search = *sessions_[s];
+            for (int k = 0; k != search.lattice_.back().size(); k++) {
+                search.ReplayShard(&search.shards_[k]);
+            }
+        }
+        ExpandSources(true);
+
+        for (int s : shared_) {
+            Search& search = *sessions_[s];
+            for (int k = 0; k != search.lattice_.back().size(); k++) {
+                search.RecombineShard(search.shards_[k]);
+            }
+            search.stats_.num_batched_frames++;
+        }
+    }
+
+
+    // One pass of all sources, each state's emitting arcs are visited once for all its sources
+    void ExpandSources(bool pass_tokens) {
+        for (const Source& x : sources_) {
+            Search& search = *sessions_[x.session];
+            search.BeginShard(pass_tokens, &search.shards_[x.k]);
+        }
+
+        size_t end;
+        for (size_t begin = 0; begin != sources_.size(); begin = end) {
+            const Fsm& graph = *sources_[begin].graph;
+            FsmStateId state = sources_[begin].state;
+            for (end = begin + 1; end != sources_.size(); end++) {
+                if (sources_[end].graph != &graph || sources_[end].state != state) {
+                    break;
+                }
+            }
+
+            for (auto aiter = graph.GetArcIterator(state); !aiter.Done(); aiter.Next()) {
+                const FsmArc& arc = aiter.Value();
+                if (arc.ilabel == kFsmEpsilon || arc.ilabel == kFsmInputEnd) {
+                    continue;
+                }
+                for (size_t i = begin; i != end; i++) {
+                    const Source& x = sources_[i];
+                    Search& search = *sessions_[x.session];
+                    search.ExpandShardArc(frame_scores_[x.session], score_offsets_[x.session], x.k, x.g, arc,
+                        pass_tokens, &search.shards_[x.k]
+                    );
+                }
+            }
+        }
+    }
+
+}; // class BatchBeamSearch
+}  // namespace sio
+#endif
@@ -0,0 +1,120 @@
+#include "sio/batch_search.h"
+
+#include <math.h>
+#include <random>
+#include <sstream>
+
+#include <torch/torch.h>
+#include <gtest/gtest.h>
+
+namespace sio {
+
+// synthetic CTC log-posteriors: [num_frames, vocab_size], blank_ratio of frames are confident blanks
+static Vec<Vec<f32>> SyntheticPosteriors(const Tokenizer& tokenizer, int num_frames, f32 blank_ratio, u32 seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<f32> uniform(0.0, 1.0);
+    std::uniform_int_distribution<TokenId> random_token(4, tokenizer.Size() - 1); // after special tokens
+
+    int vocab = tokenizer.Size();
+    Vec<Vec<f32>> posteriors(num_frames, Vec<f32>(vocab));
+    for (auto& frame : posteriors) {
+        bool blank_frame = uniform(rng) < blank_ratio;
+        TokenId peak_token = blank_frame ? tokenizer.blk : random_token(rng);
+        f32 peak = blank_frame ? 0.9 + 0.09 * uniform(rng) : 0.3 + 0.6 * uniform(rng);
+        for (TokenId t = 0; t != vocab; t++) {
+            f32 p = (t == peak_token) ? peak : (1.0 - peak) * (0.5 + uniform(rng)) / vocab;
+            frame[t] = log(p);
+        }
+    }
+    return posteriors;
+}
+
+
+TEST(BatchBeamSearch, MatchSingleSession) {
+    Tokenizer tokenizer;
+    {
+        std::stringstream vocab;
+        vocab << "<blk> 0\n<unk> 0\n<s> 0\n</s> 0\n";
+        for (int k = 0; k != 1000; k++) {
+            vocab << "t" << k << " -1.0\n";
+        }
+        tokenizer.Load(vocab);
+    }
+
+    Fsm graph;
+    graph.BuildTokenTopology(tokenizer);
+
+    // staggered sessions of different lengths, so batches mix sessions at different times
+    int batch_size = 4;
+    Vec<int> begin_frames = {0, 0, 30, 75};
+    Vec<Vec<Vec<f32>>> scores;
+    for (int s = 0; s != batch_size; s++) {
+        scores.push_back(SyntheticPosteriors(tokenizer, 120 + 20 * s, 0.3, 100 + s));
+    }
+
+    BeamSearchConfig config;
+    config.beam = 6.0;  // binding during expansion, so beam updates are replayed exactly
+    config.max_active = 256;
+    config.token_set_size = 4;
+    config.nbest = 4;
+    config.insertion_penalty = 0.5;
+
+    // lattice mode, and blank skipped frames expanded by each session on its own
+    for (auto mode : Vec<std::pair<f32, f32>>{{0.0, 0.0}, {8.0, 0.95}}) {
+        config.lattice_beam = mode.first;
+        config.blank_skip_threshold = mode.second;
+
+        BatchBeamSearch<> batch_search;
+        batch_search.Load(config, graph, tokenizer, batch_size);
+
+        Vec<f32> matrix;
+        Vec<int> sessions;
+        for (int f = 0, num_done = 0; num_done != batch_size; f++) {
+            matrix.clear();
+            sessions.clear();
+            for (int s = 0; s != batch_size; s++) {
+                int t = f - begin_frames[s];
+                if (t >= 0 && t < scores[s].size()) {
+                    matrix.insert(matrix.end(), scores[s][t].begin(), scores[s][t].end());
+                    sessions.push_back(s);
+                }
+            }
+            if (!sessions.empty()) {
+                batch_search.Push(matrix.data(), tokenizer.Size(), sessions);
+            }
+
+            for (int s = 0; s != batch_size; s++) {
+                if (f - begin_frames[s] + 1 != scores[s].size()) {
+                    continue;
+                }
+                batch_search.PushEos(s);
+                num_done++;
+
+                BeamSearch<> search;
+                search.Load(config, graph, tokenizer);
+                for (auto& frame : scores[s]) {
+                    search.Push(frame.data());
+                }
+                search.PushEos();
+                EXPECT_EQ(batch_search.NBest(s), search.NBest());
+                EXPECT_EQ(batch_search.NBest(s).size(), config.nbest);
+
+                const SearchStats& x = search.Stats();
+                const SearchStats& y = batch_search.Session(s).Stats();
+                EXPECT_EQ(x.num_batched_frames, 0);
+                EXPECT_GT(y.num_batched_frames, scores[s].size() / 2);
+                EXPECT_EQ(x.num_blank_skipped_frames, y.num_blank_skipped_frames);
+                EXPECT_EQ(x.num_arcs_visited, y.num_arcs_visited);
+                EXPECT_EQ(x.num_tokens_created, y.num_tokens_created);
+                EXPECT_EQ(x.num_tokens_recombined, y.num_tokens_recombined);
+                EXPECT_EQ(x.num_lm_calls, y.num_lm_calls);
+                EXPECT_EQ(x.num_lattice_arcs, y.num_lattice_arcs);
+                EXPECT_EQ(x.active_token_sets.Sum(), y.active_token_sets.Sum());
+
+                batch_search.Reset(s);
+            }
+        }
+    }
+}
+
+} // namespace sio
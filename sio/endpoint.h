@@ -0,0 +1,68 @@
+#ifndef SIO_ENDPOINT_H
+#define SIO_ENDPOINT_H
+
+#include "sio/base.h"
+#include "sio/struct_loader.h"
+
+namespace sio {
+
+/*
+ * An endpoint rule matches when all of its conditions hold:
+ *   1. something other than blank is decoded in best path, if must_decode_anything
+ *   2. trailing blank of best path lasts at least min_trailing_silence seconds
+ *   3. utterance lasts at least min_utterance_length seconds
+ */
+struct EndpointRule {
+    bool must_decode_anything = false;
+    f32 min_trailing_silence = 0.0;
+    f32 min_utterance_length = 0.0;
+
+    EndpointRule(bool must_decode_anything, f32 min_trailing_silence, f32 min_utterance_length) :
+        must_decode_anything(must_decode_anything),
+        min_trailing_silence(min_trailing_silence),
+        min_utterance_length(min_utterance_length)
+    { }
+
+
+    Error Register(StructLoader* loader, const std::string module = "") {
+        loader->AddEntry(module + ".must_decode_anything", &must_decode_anything);
+        loader->AddEntry(module + ".min_trailing_silence", &min_trailing_silence);
+        loader->AddEntry(module + ".min_utterance_length", &min_utterance_length);
+        return Error::OK;
+    }
+
+
+    bool Match(bool decoded_anything, f32 trailing_silence, f32 utterance_length) const {
+        return (decoded_anything || !must_decode_anything) &&
+            trailing_silence >= min_trailing_silence &&
+            utterance_length >= min_utterance_length;
+    }
+};
+
+
+// Endpoint is detected when any rule matches, defaults are simplified from Kaldi's online endpointing.
+struct EndpointConfig {
+    EndpointRule rule1 = {false, 5.0, 0.0};   // long silence, even if nothing is decoded
+    EndpointRule rule2 = {true, 1.0, 0.0};    // trailing silence after speech
+    EndpointRule rule3 = {false, 0.0, 20.0};  // max utterance length
+
+    Error Register(StructLoader* loader, const std::string module = "") {
+        rule1.Register(loader, module + ".rule1");
+        rule2.Register(loader, module + ".rule2");
+        rule3.Register(loader, module + ".rule3");
+        return Error::OK;
+    }
+};
+
+
+// trailing_silence & utterance_length are in seconds
+static inline bool DetectEndpoint(
+    const EndpointConfig& config, bool decoded_anything, f32 trailing_silence, f32 utterance_length
+) {
+    return config.rule1.Match(decoded_anything, trailing_silence, utterance_length) ||
+        config.rule2.Match(decoded_anything, trailing_silence, utterance_length) ||
+        config.rule3.Match(decoded_anything, trailing_silence, utterance_length);
+}
+
+} // namespace sio
+#endif
@@ -0,0 +1,26 @@
+#include "sio/endpoint.h"
+
+#include <gtest/gtest.h>
+
+namespace sio {
+
+TEST(Endpoint, Rules) {
+    EndpointConfig config;
+
+    // rule1: long silence without speech
+    EXPECT_FALSE(DetectEndpoint(config, false, 4.9, 4.9));
+    EXPECT_TRUE(DetectEndpoint(config, false, 5.0, 5.0));
+
+    // rule2: short trailing silence after speech
+    EXPECT_FALSE(DetectEndpoint(config, true, 0.5, 3.0));
+    EXPECT_TRUE(DetectEndpoint(config, true, 1.0, 3.0));
+
+    // rule3: max utterance length
+    EXPECT_FALSE(DetectEndpoint(config, true, 0.0, 19.9));
+    EXPECT_TRUE(DetectEndpoint(config, true, 0.0, 20.0));
+
+    config.rule3.min_utterance_length = 30.0;
+    EXPECT_FALSE(DetectEndpoint(config, true, 0.0, 20.0));
+}
+
+} // namespace sio
@@ -13,6 +13,7 @@ const char* ErrorMsg(Error err) {
         case Error::InvalidFileHandle: return "invalid file handle";
         case Error::VocabularyMismatch: return "mismatched vocabulary of tokenizer and KenLM";
         case Error::NoRecognitionResult: return "no recognition result";
+        case Error::InvalidSnapshot: return "invalid or mismatched session snapshot";
         case Error::Unknown: return "(unknown error)";
     }
     return nullptr; /* avoid warning */
@@ -12,6 +12,7 @@ enum class Error : int {
     InvalidFileHandle,
     VocabularyMismatch,
     NoRecognitionResult,
+    InvalidSnapshot,
     Unknown,
 }; // enum class Error
 
@@ -2,12 +2,15 @@
 #define SIO_FEATURE_EXTRACTOR_H
 
 #include <memory>
+#include <deque>
+#include <algorithm>
 
 #include "feat/online-feature.h"
 
 #include "sio/base.h"
 #include "sio/struct_loader.h"
 #include "sio/mean_var_norm.h"
+#include "sio/snapshot.h"
 
 namespace sio {
 struct FeatureExtractorConfig {
@@ -37,6 +40,14 @@ class FeatureExtractor {
     // [cur_frame_, NumFramesReady()) ~ remainder frames.
     index_t cur_frame_ = 0;
 
+    // session handover, see Snapshot():
+    //   waveform_tail_: samples from the 1st frame not extracted yet, i.e. samples still needed by future frames
+    //   restored_frames_: remainder frames of a restored session (not normalized), popped before extractor's
+    f32 sample_rate_ = 0.0;
+    Vec<f32> waveform_tail_;
+    i64 num_samples_ = 0;  // samples accepted by extractor_
+    std::deque<Vec<f32>> restored_frames_;
+
 public:
 
     Error Load(const FeatureExtractorConfig& config, Nullable<const MeanVarNorm*> mvn = nullptr) { 
@@ -59,6 +70,9 @@ public:
             sample_rate, 
             kaldi::SubVector<f32>(samples, num_samples)
         );
+
+        sample_rate_ = sample_rate;
+        UpdateWaveformTail(samples, num_samples);
     }
 
 
@@ -70,16 +84,33 @@ public:
     Vec<f32> Pop() {
         SIO_CHECK_GT(Size(), 0);
         Vec<f32> feat_frame(Dim(), 0.0f);
+        PopBatch(1, feat_frame.data(), feat_frame.size());
+        return feat_frame;
+    }
 
-        // kaldi_frame is a helper frame view, no underlying data ownership
-        kaldi::SubVector<f32> kaldi_frame(feat_frame.data(), feat_frame.size());
-        extractor_->GetFrame(cur_frame_, &kaldi_frame);
-        if (mean_var_norm_) {
-            mean_var_norm_->Normalize(&kaldi_frame);
-        }
-        cur_frame_++;
 
-        return std::move(feat_frame);
+    // Pops up to max_frames ready frames into caller-owned memory, e.g. scorer's feature buffer,
+    // frame k is written to out[k * stride, k * stride + Dim()), returns number of frames popped.
+    size_t PopBatch(size_t max_frames, f32* out, size_t stride) {
+        SIO_CHECK_GE(stride, Dim());
+        size_t n = std::min(max_frames, Size());
+        for (size_t k = 0; k != n; k++) {
+            // kaldi_frame is a helper frame view, no underlying data ownership
+            kaldi::SubVector<f32> kaldi_frame(out + k * stride, Dim());
+
+            if (!restored_frames_.empty()) {
+                std::copy(restored_frames_.front().begin(), restored_frames_.front().end(), out + k * stride);
+                restored_frames_.pop_front();
+            } else {
+                extractor_->GetFrame(cur_frame_, &kaldi_frame);
+                cur_frame_++;
+            }
+
+            if (mean_var_norm_) {
+                mean_var_norm_->Normalize(&kaldi_frame);
+            }
+        }
+        return n;
     }
 
 
@@ -89,6 +120,63 @@ public:
         extractor_ = std::make_unique<kaldi::OnlineFbank>(config_->fbank);
         cur_frame_ = 0;
 
+        waveform_tail_.clear();
+        num_samples_ = 0;
+        restored_frames_.clear();
+
+        return Error::OK;
+    }
+
+
+    // Session handover: remainder frames & waveform tail are written,
+    // restored extractor re-extracts future frames from the tail, which is exact with snip_edges framing
+    // (except for dither noise). Should be called before PushEos().
+    Error Snapshot(SnapshotWriter* w) {
+        if (!config_->fbank.frame_opts.snip_edges) {
+            SIO_ERROR << "Feature snapshot requires snip_edges framing.";
+            return Error::InvalidSnapshot;
+        }
+
+        w->PutTag("FEAT");
+        w->Put<f32>(sample_rate_);
+        w->Put<u64>(Size());
+        for (const Vec<f32>& frame : restored_frames_) {
+            w->PutVec(frame);
+        }
+        Vec<f32> frame(Dim());
+        for (index_t f = cur_frame_; f != extractor_->NumFramesReady(); f++) {
+            kaldi::SubVector<f32> kaldi_frame(frame.data(), frame.size());
+            extractor_->GetFrame(f, &kaldi_frame);
+            w->PutVec(frame);
+        }
+        w->PutVec(waveform_tail_);
+
+        return Error::OK;
+    }
+
+
+    Error Restore(SnapshotReader* r) {
+        Reset();
+
+        u64 num_frames = 0;
+        SIO_SNAPSHOT_GET(r->ExpectTag("FEAT"));
+        SIO_SNAPSHOT_GET(r->Get(&sample_rate_));
+        SIO_SNAPSHOT_GET(r->Get(&num_frames));
+        for (u64 f = 0; f != num_frames; f++) {
+            Vec<f32> frame;
+            SIO_SNAPSHOT_GET(r->GetVec(&frame));
+            if (frame.size() != Dim()) {
+                return Error::InvalidSnapshot;
+            }
+            restored_frames_.push_back(std::move(frame));
+        }
+
+        Vec<f32> tail;
+        SIO_SNAPSHOT_GET(r->GetVec(&tail));
+        if (!tail.empty()) {
+            Push(tail.data(), tail.size(), sample_rate_);
+        }
+
         return Error::OK;
     }
 
@@ -99,7 +187,7 @@ public:
 
 
     size_t Size() const {
-        return extractor_->NumFramesReady() - cur_frame_;
+        return restored_frames_.size() + extractor_->NumFramesReady() - cur_frame_;
     }
 
 
@@ -114,6 +202,24 @@ public:
         return 1000.0f / config_->fbank.frame_opts.frame_shift_ms;
     }
 
+private:
+
+    // Keeps samples from the 1st frame not extracted yet, i.e. at most about one window:
+    // older tail samples are dropped, & only the needed end of incoming samples is copied.
+    void UpdateWaveformTail(const f32* samples, size_t num_samples) {
+        i64 tail_begin = num_samples_ - waveform_tail_.size();
+        num_samples_ += num_samples;
+        i64 needed_begin = static_cast<i64>(extractor_->NumFramesReady()) * config_->fbank.frame_opts.WindowShift();
+
+        if (needed_begin > tail_begin) {
+            i64 n = std::min<i64>(needed_begin - tail_begin, waveform_tail_.size());
+            waveform_tail_.erase(waveform_tail_.begin(), waveform_tail_.begin() + n);
+        }
+        i64 incoming_begin = num_samples_ - num_samples;
+        i64 skip = std::min<i64>(std::max<i64>(needed_begin - incoming_begin, 0), num_samples);
+        waveform_tail_.insert(waveform_tail_.end(), samples + skip, samples + num_samples);
+    }
+
 }; // class FeatureExtractor
 }  // namespace sio
 #endif
@@ -42,4 +42,42 @@ TEST(Feature, Extractor) {
     }
 }
 
+
+TEST(Feature, PopBatch) {
+    FeatureExtractorConfig config;
+    config.type = "fbank";
+    config.fbank.frame_opts.samp_freq = 16000;
+    config.fbank.frame_opts.dither = 0.0; // deterministic, so both extractors agree
+    config.fbank.mel_opts.num_bins = 80;
+
+    Vec<f32> audio;
+    f32 sample_rate;
+    ReadAudio("testdata/MINI/audio/audio1.wav", &audio, &sample_rate);
+
+    FeatureExtractor x, y;
+    x.Load(config);
+    y.Load(config);
+    for (FeatureExtractor* e : {&x, &y}) {
+        e->Push(audio.data(), audio.size(), sample_rate);
+        e->PushEos();
+    }
+
+    size_t dim = x.Dim();
+    size_t stride = dim + 3; // padded rows, padding is left untouched
+    size_t num_frames = x.Size();
+    Vec<f32> batch(num_frames * stride, -123.0f);
+    size_t n = 0;
+    while (y.Size() > 0) {
+        n += y.PopBatch(50, batch.data() + n * stride, stride);
+    }
+    EXPECT_EQ(n, num_frames);
+    EXPECT_EQ(y.PopBatch(50, batch.data(), stride), 0);
+
+    for (size_t f = 0; f != num_frames; f++) {
+        Vec<f32> frame = x.Pop();
+        EXPECT_TRUE(std::equal(frame.begin(), frame.end(), batch.begin() + f * stride));
+        EXPECT_EQ(batch[f * stride + dim], -123.0f);
+    }
+}
+
 } // namespace sio
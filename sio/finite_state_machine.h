@@ -18,6 +18,7 @@ using FsmScore   = f32;
 
 constexpr FsmLabel kFsmInputEnd = -1; // This follows K2Fsa convention
 constexpr FsmLabel kFsmEpsilon = std::numeric_limits<FsmLabel>::lowest();
+constexpr FsmArcId kFsmNoArc = -1;
 
 
 struct FsmState {
@@ -82,6 +83,11 @@ struct Fsm {
     }
 
 
+    inline FsmArcId ArcId(const FsmArc& arc) const {
+        return static_cast<FsmArcId>(&arc - this->arcs.data());
+    }
+
+
     FsmArcIterator GetArcIterator(FsmStateId i) const {
         SIO_CHECK(!Empty());
         SIO_CHECK_NE(i, this->states.size() - 1); // block external access to sentinel
@@ -0,0 +1,130 @@
+#ifndef SIO_HISTOGRAM_H
+#define SIO_HISTOGRAM_H
+
+#include <math.h>
+#include <limits>
+#include <algorithm>
+
+#include "sio/base.h"
+
+namespace sio {
+
+/*
+ * Histogram of a scalar metric, e.g. active token sets per frame.
+ *   1. buckets are fixed at construction, either linear or exponential,
+ *      so that histograms of the same layout can be merged across sessions.
+ *   2. bucket k covers [bounds[k-1], bounds[k]), the first & last buckets are open ended.
+ *   3. count, sum, min & max are exact, quantiles are interpolated inside a bucket.
+ */
+class Histogram {
+    Vec<f32> bounds_;  // ascending upper bounds of all buckets but the last one
+    Vec<i64> counts_;  // bounds_.size() + 1 buckets
+
+    i64 count_ = 0;
+    f64 sum_ = 0.0;
+    f32 min_ = std::numeric_limits<f32>::max();
+    f32 max_ = std::numeric_limits<f32>::lowest();
+
+public:
+
+    Histogram() : counts_(1, 0) { }
+
+
+    // num_buckets buckets of equal width in [lo, hi), plus underflow & overflow buckets
+    static Histogram Linear(f32 lo, f32 hi, int num_buckets) {
+        SIO_CHECK_LT(lo, hi);
+        SIO_CHECK_GT(num_buckets, 0);
+
+        Histogram h;
+        f32 width = (hi - lo) / num_buckets;
+        for (int k = 0; k <= num_buckets; k++) {
+            h.bounds_.push_back(lo + k * width);
+        }
+        h.counts_.resize(h.bounds_.size() + 1, 0);
+        return h;
+    }
+
+
+    // buckets [0, first), [first, first * factor), [first * factor, first * factor^2) ..., num_buckets in total
+    static Histogram Exponential(f32 first, f32 factor, int num_buckets) {
+        SIO_CHECK_GT(first, 0.0);
+        SIO_CHECK_GT(factor, 1.0);
+        SIO_CHECK_GT(num_buckets, 1);
+
+        Histogram h;
+        f32 b = first;
+        for (int k = 0; k != num_buckets - 1; k++, b *= factor) {
+            h.bounds_.push_back(b);
+        }
+        h.counts_.resize(h.bounds_.size() + 1, 0);
+        return h;
+    }
+
+
+    inline void Add(f32 x) {
+        counts_[std::upper_bound(bounds_.begin(), bounds_.end(), x) - bounds_.begin()]++;
+        count_++;
+        sum_ += x;
+        min_ = std::min(min_, x);
+        max_ = std::max(max_, x);
+    }
+
+
+    void Merge(const Histogram& other) {
+        SIO_CHECK(bounds_ == other.bounds_); // only histograms of same layout can be merged
+        for (int k = 0; k != counts_.size(); k++) {
+            counts_[k] += other.counts_[k];
+        }
+        count_ += other.count_;
+        sum_ += other.sum_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+    }
+
+
+    void Reset() {
+        std::fill(counts_.begin(), counts_.end(), 0);
+        count_ = 0;
+        sum_ = 0.0;
+        min_ = std::numeric_limits<f32>::max();
+        max_ = std::numeric_limits<f32>::lowest();
+    }
+
+
+    i64 Count() const { return count_; }
+    f64 Sum() const { return sum_; }
+    f32 Min() const { return count_ == 0 ? 0.0 : min_; }
+    f32 Max() const { return count_ == 0 ? 0.0 : max_; }
+    f64 Mean() const { return count_ == 0 ? 0.0 : sum_ / count_; }
+
+
+    // q ~ [0, 1], e.g. 0.5 for median, 0.99 for p99
+    f32 Quantile(f32 q) const {
+        SIO_CHECK(q >= 0.0 && q <= 1.0);
+        if (count_ == 0) {
+            return 0.0;
+        }
+
+        f64 rank = q * count_;
+        i64 n = 0; // num of samples in buckets [0, k)
+        for (int k = 0; k != counts_.size(); k++) {
+            if (counts_[k] != 0 && n + counts_[k] >= rank) {
+                // open-ended buckets are clipped by observed min & max
+                f32 lo = (k == 0) ? min_ : std::max(min_, bounds_[k - 1]);
+                f32 hi = (k == bounds_.size()) ? max_ : std::min(max_, bounds_[k]);
+                return lo + (hi - lo) * static_cast<f32>((rank - n) / counts_[k]);
+            }
+            n += counts_[k];
+        }
+        return max_;
+    }
+
+
+    size_t NumBuckets() const { return counts_.size(); }
+    i64 BucketCount(int k) const { return counts_[k]; }
+    // lower bound of bucket k, lowest f32 for the first bucket
+    f32 BucketLowerBound(int k) const { return k == 0 ? std::numeric_limits<f32>::lowest() : bounds_[k - 1]; }
+
+}; // class Histogram
+} // namespace sio
+#endif
@@ -0,0 +1,53 @@
+#include "sio/histogram.h"
+
+#include <gtest/gtest.h>
+
+namespace sio {
+
+TEST(Histogram, Linear) {
+    Histogram h = Histogram::Linear(0.0, 10.0, 10);
+    EXPECT_EQ(h.NumBuckets(), 12); // + underflow & overflow
+
+    for (int i = 0; i != 100; i++) {
+        h.Add(i % 10 + 0.5);
+    }
+    h.Add(-1.0);
+    h.Add(100.0);
+
+    EXPECT_EQ(h.Count(), 102);
+    EXPECT_EQ(h.BucketCount(0), 1);
+    EXPECT_EQ(h.BucketCount(1), 10);
+    EXPECT_EQ(h.BucketCount(11), 1);
+    EXPECT_FLOAT_EQ(h.Min(), -1.0);
+    EXPECT_FLOAT_EQ(h.Max(), 100.0);
+    EXPECT_FLOAT_EQ(h.Quantile(0.0), -1.0);
+    EXPECT_FLOAT_EQ(h.Quantile(1.0), 100.0);
+    EXPECT_NEAR(h.Quantile(0.5), 5.0, 0.1);
+}
+
+
+TEST(Histogram, ExponentialMerge) {
+    Histogram x = Histogram::Exponential(1.0, 2.0, 8); // [0,1) [1,2) [2,4) ... [64, inf)
+    Histogram y = Histogram::Exponential(1.0, 2.0, 8);
+    EXPECT_EQ(x.NumBuckets(), 8);
+
+    x.Add(0.5);
+    x.Add(3.0);
+    y.Add(3.5);
+    y.Add(1000.0);
+
+    x.Merge(y);
+    EXPECT_EQ(x.Count(), 4);
+    EXPECT_DOUBLE_EQ(x.Sum(), 1007.0);
+    EXPECT_EQ(x.BucketCount(0), 1);
+    EXPECT_EQ(x.BucketCount(2), 2);
+    EXPECT_EQ(x.BucketCount(7), 1);
+    EXPECT_FLOAT_EQ(x.BucketLowerBound(7), 64.0);
+    EXPECT_FLOAT_EQ(x.Max(), 1000.0);
+
+    x.Reset();
+    EXPECT_EQ(x.Count(), 0);
+    EXPECT_EQ(x.Quantile(0.5), 0.0);
+}
+
+} // namespace sio
@@ -2,6 +2,7 @@
 #define SIO_LANGUAGE_MODEL_H
 
 #include "sio/base.h"
+#include "sio/snapshot.h"
 
 namespace sio {
 
@@ -15,6 +16,15 @@ public:
 
     virtual LmScore GetScore(LmStateId istate, LmWordId word, LmStateId* ostate_ptr) = 0;
 
+    // GetScore() is a pure function of its arguments & never returns positive scores,
+    // so it can be called concurrently, e.g. by parallel expansion of BeamSearch.
+    virtual bool IsStateless() const { return false; }
+
+    // Session handover: LMs issuing instance specific LmStateIds write & restore their state tables,
+    // LMs with computed state ids(e.g. PrefixTreeLm) write nothing.
+    virtual Error Snapshot(SnapshotWriter* w) const { return Error::OK; }
+    virtual Error Restore(SnapshotReader* r) { return Error::OK; }
+
     virtual ~LanguageModel() { }
 };
 } // namespace sio
@@ -22,6 +22,10 @@ public:
         return 0.0;
     }
 
+    bool IsStateless() const override {
+        return true;
+    }
+
 }; // class PrefixTreeLm
 
 
@@ -87,6 +91,38 @@ public:
         return score;
     }
 
+
+    // state table in LmStateId order, so restored ids refer to the same KenLm states
+    Error Snapshot(SnapshotWriter* w) const override {
+        w->PutTag("NGLM");
+        w->Put<u64>(index_to_state_.size());
+        for (const KenLm::State* s : index_to_state_) {
+            w->Put(*s);
+        }
+        return Error::OK;
+    }
+
+
+    Error Restore(SnapshotReader* r) override {
+        SIO_CHECK(kenlm_ != nullptr);
+        SIO_SNAPSHOT_GET(r->ExpectTag("NGLM"));
+        u64 n = 0;
+        SIO_SNAPSHOT_GET(r->Get(&n));
+
+        state_to_index_.clear();
+        index_to_state_.clear();
+        for (u64 k = 0; k != n; k++) {
+            KenLm::State s;
+            SIO_SNAPSHOT_GET(r->Get(&s));
+            auto res = state_to_index_.insert({s, index_to_state_.size()});
+            if (!res.second) {
+                return Error::InvalidSnapshot;  // duplicated state
+            }
+            index_to_state_.push_back(&(res.first->first));
+        }
+        return Error::OK;
+    }
+
 }; // class NgramLm
 
 
@@ -145,6 +181,18 @@ public:
         return v.score;
     }
 
+
+    Error Snapshot(SnapshotWriter* w) const override {
+        return lm_->Snapshot(w);
+    }
+
+
+    // restored state ids may refer to other states than cached ones
+    Error Restore(SnapshotReader* r) override {
+        std::fill(caches_.begin(), caches_.end(), Cache());
+        return lm_->Restore(r);
+    }
+
 private:
 
     inline size_t GetCacheIndex(LmStateId istate, LmWordId word) {
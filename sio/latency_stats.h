@@ -0,0 +1,150 @@
+#ifndef SIO_LATENCY_STATS_H
+#define SIO_LATENCY_STATS_H
+
+#include <time.h>
+#include <chrono>
+
+#include "sio/base.h"
+#include "sio/histogram.h"
+#include "sio/json.h"
+
+namespace sio {
+
+// Wall clock milliseconds since t, a steady_clock read is ~20ns, cheap enough for per-frame stage timing
+inline f32 ElapsedMs(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration<f32, std::milli>(std::chrono::steady_clock::now() - t).count();
+}
+
+
+// CPU time of the calling thread in milliseconds, excludes time it is descheduled, unlike ElapsedMs()
+inline f64 ThreadCpuMs() {
+    timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec * 1e-6;
+}
+
+
+inline Json HistogramJson(const Histogram& h) {
+    return Json{
+        {"count", h.Count()},
+        {"mean", h.Mean()},
+        {"p50", h.Quantile(0.5)},
+        {"p95", h.Quantile(0.95)},
+        {"p99", h.Quantile(0.99)},
+        {"max", h.Max()},
+    };
+}
+
+
+/*
+ * Where latency budget of speech-to-text sessions goes, per stage of the pipeline.
+ *   1. stage histograms are recorded by the component running the stage, see ScorerStats & SearchStats,
+ *      & gathered per session by SpeechToText::Latency().
+ *   2. sessions are aggregated via Merge(), layouts are fixed so that any two LatencyStats can be merged.
+ *   3. compute time is the sum of stage busy time, so RTF is comparable between sync & async pipelines,
+ *      where stages overlap in wall clock.
+ */
+struct LatencyStats {
+    i64 num_sessions = 0;
+    f64 audio_seconds = 0.0;
+    f64 compute_seconds = 0.0;
+
+    Histogram feature_ms = Histogram::Exponential(0.01, 1.25, 56);  // per Speech() & To()
+    Histogram encoder_forward_ms = Histogram::Exponential(0.25, 1.25, 48);  // per chunk
+    Histogram ctc_activation_ms = Histogram::Exponential(0.01, 1.25, 48);  // per chunk
+    Histogram search_expand_ms = Histogram::Exponential(0.01, 1.25, 48);  // per frame, emitting & epsilon
+    Histogram search_prune_ms = Histogram::Exponential(0.01, 1.25, 48);  // per frame, prune & pin down
+    Histogram traceback_ms = Histogram::Exponential(0.01, 1.25, 48);  // per session, eos & nbest
+    Histogram first_partial_ms = Histogram::Exponential(1.0, 1.25, 48);  // first Speech() -> non-empty partial result
+    Histogram eos_to_final_ms = Histogram::Exponential(0.1, 1.25, 48);  // To() called -> final result ready
+    Histogram rtf = Histogram::Exponential(0.001, 1.25, 48);  // per session, compute / audio seconds
+
+
+    void Merge(const LatencyStats& other) {
+        num_sessions += other.num_sessions;
+        audio_seconds += other.audio_seconds;
+        compute_seconds += other.compute_seconds;
+
+        feature_ms.Merge(other.feature_ms);
+        encoder_forward_ms.Merge(other.encoder_forward_ms);
+        ctc_activation_ms.Merge(other.ctc_activation_ms);
+        search_expand_ms.Merge(other.search_expand_ms);
+        search_prune_ms.Merge(other.search_prune_ms);
+        traceback_ms.Merge(other.traceback_ms);
+        first_partial_ms.Merge(other.first_partial_ms);
+        eos_to_final_ms.Merge(other.eos_to_final_ms);
+        rtf.Merge(other.rtf);
+    }
+
+
+    void Reset() {
+        num_sessions = 0;
+        audio_seconds = 0.0;
+        compute_seconds = 0.0;
+
+        feature_ms.Reset();
+        encoder_forward_ms.Reset();
+        ctc_activation_ms.Reset();
+        search_expand_ms.Reset();
+        search_prune_ms.Reset();
+        traceback_ms.Reset();
+        first_partial_ms.Reset();
+        eos_to_final_ms.Reset();
+        rtf.Reset();
+    }
+
+
+    // aggregate RTF, i.e. weighted by audio duration
+    f64 Rtf() const {
+        return audio_seconds > 0.0 ? compute_seconds / audio_seconds : 0.0;
+    }
+
+
+    Str Report() const {
+        auto summary = [](const char* name, const Histogram& h) {
+            return absl::StrFormat("  %-20s mean:%10.3f  p50:%10.3f  p95:%10.3f  p99:%10.3f  max:%10.3f\n",
+                name, h.Mean(), h.Quantile(0.5), h.Quantile(0.95), h.Quantile(0.99), h.Max()
+            );
+        };
+
+        Str r = absl::StrFormat("sessions:%d audio_seconds:%.2f compute_seconds:%.2f rtf:%.4f\n",
+            num_sessions, audio_seconds, compute_seconds, Rtf()
+        );
+        r += summary("feature_ms", feature_ms);
+        r += summary("encoder_forward_ms", encoder_forward_ms);
+        r += summary("ctc_activation_ms", ctc_activation_ms);
+        r += summary("search_expand_ms", search_expand_ms);
+        r += summary("search_prune_ms", search_prune_ms);
+        r += summary("traceback_ms", traceback_ms);
+        r += summary("first_partial_ms", first_partial_ms);
+        r += summary("eos_to_final_ms", eos_to_final_ms);
+        r += summary("rtf", rtf);
+        return r;
+    }
+
+
+    Json ToJson() const {
+        return Json{
+            {"num_sessions", num_sessions},
+            {"audio_seconds", audio_seconds},
+            {"compute_seconds", compute_seconds},
+            {"rtf", Rtf()},
+            {"stages", {
+                {"feature_ms", HistogramJson(feature_ms)},
+                {"encoder_forward_ms", HistogramJson(encoder_forward_ms)},
+                {"ctc_activation_ms", HistogramJson(ctc_activation_ms)},
+                {"search_expand_ms", HistogramJson(search_expand_ms)},
+                {"search_prune_ms", HistogramJson(search_prune_ms)},
+                {"traceback_ms", HistogramJson(traceback_ms)},
+            }},
+            {"sessions", {
+                {"first_partial_ms", HistogramJson(first_partial_ms)},
+                {"eos_to_final_ms", HistogramJson(eos_to_final_ms)},
+                {"rtf", HistogramJson(rtf)},
+            }},
+        };
+    }
+};
+
+} // namespace sio
+#endif
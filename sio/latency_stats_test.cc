@@ -0,0 +1,50 @@
+#include "sio/latency_stats.h"
+
+#include <gtest/gtest.h>
+
+namespace sio {
+
+TEST(LatencyStats, MergeAndJson) {
+    LatencyStats x, y;
+    x.num_sessions = 1;
+    x.audio_seconds = 10.0;
+    x.compute_seconds = 1.0;
+    x.encoder_forward_ms.Add(4.0);
+    x.rtf.Add(0.1);
+
+    y.num_sessions = 1;
+    y.audio_seconds = 30.0;
+    y.compute_seconds = 1.0;
+    y.encoder_forward_ms.Add(8.0);
+    y.first_partial_ms.Add(300.0);
+    y.rtf.Add(1.0 / 30.0);
+
+    x.Merge(y);
+    EXPECT_EQ(x.num_sessions, 2);
+    EXPECT_DOUBLE_EQ(x.Rtf(), 2.0 / 40.0); // weighted by audio duration
+    EXPECT_EQ(x.encoder_forward_ms.Count(), 2);
+    EXPECT_EQ(x.rtf.Count(), 2);
+
+    Json j = x.ToJson();
+    EXPECT_EQ(j["num_sessions"].get<i64>(), 2);
+    EXPECT_EQ(j["stages"]["encoder_forward_ms"]["count"].get<i64>(), 2);
+    EXPECT_FLOAT_EQ(j["stages"]["encoder_forward_ms"]["max"].get<f32>(), 8.0);
+    EXPECT_EQ(j["stages"]["feature_ms"]["count"].get<i64>(), 0);
+    EXPECT_FLOAT_EQ(j["sessions"]["first_partial_ms"]["p99"].get<f32>(), 300.0);
+    EXPECT_EQ(Json::parse(j.dump()), j); // round trip
+
+    x.Reset();
+    EXPECT_EQ(x.num_sessions, 0);
+    EXPECT_EQ(x.encoder_forward_ms.Count(), 0);
+    EXPECT_DOUBLE_EQ(x.Rtf(), 0.0);
+}
+
+
+TEST(LatencyStats, ElapsedMs) {
+    auto begin = std::chrono::steady_clock::now();
+    f32 ms = ElapsedMs(begin);
+    EXPECT_GE(ms, 0.0);
+    EXPECT_LT(ms, 1000.0);
+}
+
+} // namespace sio
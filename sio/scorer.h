@@ -1,65 +1,134 @@
 #ifndef SIO_SCORER_H
 #define SIO_SCORER_H
 
+#include <chrono>
+
 #include "torch/script.h"
 #include "torch/torch.h"
 
 #include "sio/base.h"
+#include "sio/histogram.h"
+#include "sio/latency_stats.h"
+#include "sio/batch_scorer.h"
 #include "sio/tokenizer.h"
+#include "sio/snapshot.h"
 
 namespace sio {
 
 struct ScorerConfig {
     int chunk_size = -1;
+    // > 0: encoder attends to at most num_left_chunks history chunks, so caches & per-chunk compute are bounded,
+    // <= 0: entire history
     int num_left_chunks = -1;
+
+    // Process-wide torch thread budgets, applied once at model load (see SpeechToTextModel), not per session:
+    //   num_threads: intra-op threads of each nnet forward
+    //   num_interop_threads: inter-op threads shared by all forwards
     int num_threads = 1;
+    int num_interop_threads = 1;
 
     Error Register(StructLoader* loader, const std::string module = "") {
         loader->AddEntry(module + ".chunk_size", &chunk_size);
         loader->AddEntry(module + ".num_left_chunks", &num_left_chunks);
         loader->AddEntry(module + ".num_threads", &num_threads);
+        loader->AddEntry(module + ".num_interop_threads", &num_interop_threads);
         return Error::OK;
     }
 };
 
 
+struct ScorerStats {
+    i64 num_chunks = 0;
+    i64 num_frames = 0;  // score frames
+
+    Histogram chunk_latency_ms = Histogram::Exponential(0.25, 1.25, 48);  // encoder forward + ctc activation
+    Histogram cache_frames = Histogram::Exponential(1.0, 2.0, 20);  // subsampled frames of encoder history caches
+    // layouts match LatencyStats, into which they are gathered
+    Histogram encoder_forward_ms = Histogram::Exponential(0.25, 1.25, 48);
+    Histogram ctc_activation_ms = Histogram::Exponential(0.01, 1.25, 48);
+
+
+    void Merge(const ScorerStats& other) {
+        num_chunks += other.num_chunks;
+        num_frames += other.num_frames;
+
+        chunk_latency_ms.Merge(other.chunk_latency_ms);
+        cache_frames.Merge(other.cache_frames);
+        encoder_forward_ms.Merge(other.encoder_forward_ms);
+        ctc_activation_ms.Merge(other.ctc_activation_ms);
+    }
+
+
+    void Reset() {
+        num_chunks = 0;
+        num_frames = 0;
+
+        chunk_latency_ms.Reset();
+        cache_frames.Reset();
+        encoder_forward_ms.Reset();
+        ctc_activation_ms.Reset();
+    }
+
+
+    Str Report() const {
+        auto summary = [](const char* name, const Histogram& h) {
+            return absl::StrFormat("  %-20s mean:%10.2f  p50:%10.2f  p90:%10.2f  p99:%10.2f  max:%10.2f\n",
+                name, h.Mean(), h.Quantile(0.5), h.Quantile(0.9), h.Quantile(0.99), h.Max()
+            );
+        };
+
+        Str r = absl::StrFormat("chunks:%d frames:%d\n", num_chunks, num_frames);
+        r += summary("chunk_latency_ms", chunk_latency_ms);
+        r += summary("cache_frames", cache_frames);
+        r += summary("encoder_forward_ms", encoder_forward_ms);
+        r += summary("ctc_activation_ms", ctc_activation_ms);
+        return r;
+    }
+};
+
+
 class Scorer {
     ScorerConfig config_;
     torch::jit::script::Module* nnet_ = nullptr;
+    BatchScorer* batch_scorer_ = nullptr;  // shared across sessions, nullptr -> forward on its own
     int nnet_idim_ = 0;
     int nnet_odim_ = 0;
 
     int subsampling_factor_ = 0;
     int right_context_ = 0;
 
-    // nnet input cache
-    std::deque<Vec<f32>> feat_cache_;
+    // nnet input cache: [num_cached_feat_frames_, nnet_idim_] row-major, wrapped as nnet input without copy.
+    // After each chunk, lookahead frames are moved to the front, so the buffer only grows beyond
+    // one chunk in non-streaming mode.
+    Vec<f32> feat_cache_;
+    index_t num_cached_feat_frames_ = 0;
     index_t cur_feat_frame_ = 0; // feats[0, cur_feat_frame_) pushed
 
     // nnet internal cache
     torch::jit::IValue subsampling_cache_;
     torch::jit::IValue elayers_output_cache_;
     torch::jit::IValue conformer_cnn_cache_;
-    Vec<torch::Tensor> acoustic_encoding_cache_;
 
     // nnet output cache
     std::deque<torch::Tensor> scores_cache_;
     index_t cur_score_frame_ = 0; // scores[0, cur_score_frame_) ready, notice: output frame counts is subsampled
 
+    ScorerStats stats_;
+
 public:
 
-    Error Load(const ScorerConfig& config, torch::jit::script::Module& nnet, int nnet_idim, int nnet_odim) { 
+    Error Load(const ScorerConfig& config, torch::jit::script::Module& nnet, int nnet_idim, int nnet_odim,
+               BatchScorer* batch_scorer = nullptr) { 
         SIO_CHECK(nnet_ == nullptr); // Can't reload
         config_ = config;
         nnet_ = &nnet;
+        batch_scorer_ = batch_scorer;
         nnet_idim_ = nnet_idim;
         nnet_odim_ = nnet_odim;
 
-        torch::set_num_threads(config_.num_threads);
-        //at::set_num_threads(config_.num_threads);
-
-        torch::NoGradGuard no_grad;
-        nnet_->eval();
+        // nnet is shared by sessions, so it's switched to eval mode once by its owner, see SpeechToTextModel::Load().
+        // Sessions only run its methods, which is thread-safe for a module not being modified.
+        SIO_CHECK(!nnet_->is_training());
 
         cur_feat_frame_ = 0;
         cur_score_frame_ = 0;
@@ -70,21 +139,69 @@ public:
         right_context_ = nnet_->run_method("right_context").toInt(); 
         SIO_INFO << "right context: " << right_context_;
 
+        if (config_.chunk_size > 0) {
+            feat_cache_.resize(ChunkFeatFrames() * nnet_idim_);
+        }
+
         return Error::OK;
     }
 
 
     void Push(const Vec<f32>& feat_frame) {
-        feat_cache_.emplace_back(feat_frame);
-        ++cur_feat_frame_;
+        SIO_CHECK_EQ(feat_frame.size(), nnet_idim_);
+        Push(feat_frame.data(), 1);
+    }
+
+
+    // feats: [num_frames, FeatDim()] row-major
+    void Push(const f32* feats, size_t num_frames) {
+        while (num_frames != 0) {
+            size_t n = 0;
+            f32* slots = FeatSlots(num_frames, &n);
+            std::copy(feats, feats + n * nnet_idim_, slots);
+            CommitFeats(n);
+            feats += n * nnet_idim_;
+            num_frames -= n;
+        }
+    }
+
+
+    // Zero-copy feature input, e.g. via FeatureExtractor::PopBatch():
+    //   FeatSlots() returns free rows of the feature buffer, *num_frames ~ [1, max_frames] of them,
+    //   caller writes frames there with stride FeatDim(), then CommitFeats() with the number of frames written.
+    // In streaming mode, slots stop at the end of current chunk, so a commit completes at most one chunk.
+    f32* FeatSlots(size_t max_frames, size_t* num_frames) {
+        SIO_CHECK_GT(max_frames, 0);
+        size_t n = max_frames;
+        if (config_.chunk_size > 0) {
+            n = std::min<size_t>(n, ChunkFeatFrames() - num_cached_feat_frames_);
+        }
+        size_t required = (num_cached_feat_frames_ + n) * nnet_idim_;
+        if (required > feat_cache_.size()) {
+            feat_cache_.resize(std::max(2 * feat_cache_.size(), required)); // non-streaming only
+        }
+        *num_frames = n;
+        return feat_cache_.data() + num_cached_feat_frames_ * nnet_idim_;
+    }
+
+
+    void CommitFeats(size_t num_frames) {
+        num_cached_feat_frames_ += num_frames;
+        cur_feat_frame_ += num_frames;
 
         if (config_.chunk_size > 0) { // chunk-based streaming
-            if (feat_cache_.size() == config_.chunk_size * subsampling_factor_ + right_context_) {
+            SIO_CHECK_LE(num_cached_feat_frames_, ChunkFeatFrames());
+            if (num_cached_feat_frames_ == ChunkFeatFrames()) {
                 Advance();
 
                 // lookahead frames(right_context) are needed for next chunk
-                while (feat_cache_.size() > right_context_) {
-                    feat_cache_.pop_front();
+                if (num_cached_feat_frames_ > right_context_) {
+                    std::copy(
+                        feat_cache_.begin() + (num_cached_feat_frames_ - right_context_) * nnet_idim_,
+                        feat_cache_.begin() + num_cached_feat_frames_ * nnet_idim_,
+                        feat_cache_.begin()
+                    );
+                    num_cached_feat_frames_ = right_context_;
                 }
             }
         }
@@ -92,10 +209,10 @@ public:
 
 
     void PushEos() {
-        if (feat_cache_.size() > right_context_) {
+        if (num_cached_feat_frames_ > right_context_) {
             Advance();
         }
-        feat_cache_.clear();
+        num_cached_feat_frames_ = 0;
     }
 
 
@@ -107,13 +224,12 @@ public:
 
 
     Error Reset() {
-        feat_cache_.clear();
+        num_cached_feat_frames_ = 0; // buffer is kept for next session
         cur_feat_frame_ = 0;
 
         subsampling_cache_ = std::move(torch::jit::IValue());
         elayers_output_cache_ = std::move(torch::jit::IValue());
         conformer_cnn_cache_ = std::move(torch::jit::IValue());
-        acoustic_encoding_cache_.clear();
 
         scores_cache_.clear();
         cur_score_frame_ = 0;
@@ -127,58 +243,138 @@ public:
     }
 
 
+    int FeatDim() const {
+        return nnet_idim_;
+    }
+
+
     size_t Dim() const {
         return 0; // TODO: this should be the dim of nnet output
     }
 
+
+    // num of feature frames per score frame
+    int SubsamplingFactor() const {
+        return subsampling_factor_;
+    }
+
+
+    // accumulated over sessions until ResetStats(), so long streams & multiple utterances are covered alike
+    const ScorerStats& Stats() const { return stats_; }
+    void ResetStats() { stats_.Reset(); }
+
+
+    // Session handover: feature & score caches are written as raw floats, nnet internal caches are pickled.
+    Error Snapshot(SnapshotWriter* w) const {
+        w->PutTag("SCOR");
+        w->Put<i64>(cur_feat_frame_);
+        w->Put<i64>(cur_score_frame_);
+
+        w->PutVec(feat_cache_.data(), num_cached_feat_frames_ * nnet_idim_);
+
+        for (const torch::jit::IValue* cache : {&subsampling_cache_, &elayers_output_cache_, &conformer_cnn_cache_}) {
+            w->PutVec(torch::jit::pickle_save(*cache));
+        }
+
+        w->Put<u64>(scores_cache_.size());
+        for (const torch::Tensor& score_frame : scores_cache_) {
+            torch::Tensor x = score_frame.contiguous();
+            w->PutVec(x.data_ptr<float>(), x.numel());
+        }
+
+        return Error::OK;
+    }
+
+
+    Error Restore(SnapshotReader* r) {
+        Reset();
+
+        i64 cur_feat_frame = 0, cur_score_frame = 0;
+        u64 n = 0;
+        SIO_SNAPSHOT_GET(r->ExpectTag("SCOR"));
+        SIO_SNAPSHOT_GET(r->Get(&cur_feat_frame));
+        SIO_SNAPSHOT_GET(r->Get(&cur_score_frame));
+        cur_feat_frame_ = cur_feat_frame;
+        cur_score_frame_ = cur_score_frame;
+
+        Vec<f32> feats;
+        SIO_SNAPSHOT_GET(r->GetVec(&feats));
+        if (feats.size() % nnet_idim_ != 0) {
+            return Error::InvalidSnapshot;
+        }
+        num_cached_feat_frames_ = feats.size() / nnet_idim_;
+        if (feats.size() > feat_cache_.size()) {
+            feat_cache_.resize(feats.size());
+        }
+        std::copy(feats.begin(), feats.end(), feat_cache_.begin());
+
+        for (torch::jit::IValue* cache : {&subsampling_cache_, &elayers_output_cache_, &conformer_cnn_cache_}) {
+            Vec<char> pickled;
+            SIO_SNAPSHOT_GET(r->GetVec(&pickled));
+            *cache = torch::jit::pickle_load(pickled);
+        }
+
+        SIO_SNAPSHOT_GET(r->Get(&n));
+        for (u64 f = 0; f != n; f++) {
+            Vec<f32> score_frame;
+            SIO_SNAPSHOT_GET(r->GetVec(&score_frame));
+            scores_cache_.push_back(
+                torch::from_blob(score_frame.data(), {static_cast<long>(score_frame.size())}, torch::kFloat).clone()
+            );
+        }
+
+        return Error::OK;
+    }
+
 private:
+    // feature frames consumed by one chunk, including lookahead
+    index_t ChunkFeatFrames() const {
+        return config_.chunk_size * subsampling_factor_ + right_context_;
+    }
+
+
     Error Advance() {
         //dbg(cur_feat_frame_);
         torch::NoGradGuard no_grad;
+        auto chunk_begin = std::chrono::steady_clock::now();
 
-        // Prepare feature chunk tensor: [batch_size = 1, num_cached_frames, feature_dim]
-        torch::Tensor chunk_feat = torch::zeros(
-            {1, static_cast<long>(feat_cache_.size()), nnet_idim_}, 
+        // Feature chunk tensor: [batch_size = 1, num_cached_frames, feature_dim], a view of feat_cache_,
+        // encoder outputs don't alias its input, so the buffer can be overwritten after forward.
+        torch::Tensor chunk_feat = torch::from_blob(
+            feat_cache_.data(),
+            {1, static_cast<long>(num_cached_feat_frames_), nnet_idim_},
             torch::kFloat
         );
-        for (index_t f = 0; f != feat_cache_.size(); f++) {
-            torch::Tensor frame_tensor = torch::from_blob(
-                feat_cache_[f].data(),
-                { nnet_idim_ },
-                torch::kFloat
-            ).clone();
-            chunk_feat[0][f] = std::move(frame_tensor);
-        }
 
         // FIX THIS: extremely confusing units due to subsampling factor
         // here offset refers to sub-sampled frames
         // assemble feature and caches as input
+        EncoderChunk chunk;
+        chunk.feat = chunk_feat;
+        chunk.offset = cur_score_frame_;
 
-        //int requried_cache_size = config_.chunk_size * config_.num_left_chunks;
-        int requried_cache_size = -1; // < 0 : use entire history caches
-        Vec<torch::jit::IValue> chunk_input = {
-            chunk_feat,
-            cur_score_frame_,
-            requried_cache_size,
-            subsampling_cache_,
-            elayers_output_cache_,
-            conformer_cnn_cache_
-        };
-
-        // Encoder forward
-        auto r = nnet_->get_method("forward_encoder_chunk")(chunk_input).toTuple()->elements();
+        // subsampled frames of history kept in returned caches, < 0 : use entire history caches
+        if (config_.chunk_size > 0 && config_.num_left_chunks > 0) {
+            chunk.required_cache_size = config_.chunk_size * config_.num_left_chunks;
+        }
+        chunk.subsampling_cache = std::move(subsampling_cache_);
+        chunk.elayers_output_cache = std::move(elayers_output_cache_);
+        chunk.conformer_cnn_cache = std::move(conformer_cnn_cache_);
+
+        // Encoder forward & ctc activation, possibly batched with chunks of other sessions
+        if (batch_scorer_ != nullptr) {
+            batch_scorer_->Forward(&chunk);
+        } else {
+            ForwardEncoderChunks(*nnet_, {&chunk});
+        }
 
         // Cache encoder buffers & results
-        SIO_CHECK_EQ(r.size(), 4);
-        torch::Tensor acoustic_encoding = r[0].toTensor();
-        // what is "assign" semantics for torch::jit:IValue ?
-        subsampling_cache_ = r[1];
-        elayers_output_cache_ = r[2];
-        conformer_cnn_cache_ = r[3];
-        acoustic_encoding_cache_.push_back(acoustic_encoding);
+        subsampling_cache_ = std::move(chunk.subsampling_cache);
+        elayers_output_cache_ = std::move(chunk.elayers_output_cache);
+        conformer_cnn_cache_ = std::move(chunk.conformer_cnn_cache);
 
-        // Compute chunk scores: [frames, nnet_odim]
-        torch::Tensor scores = nnet_->run_method("ctc_activation", acoustic_encoding).toTensor()[0];
+        // Chunk scores: [frames, nnet_odim]
+        torch::Tensor scores = chunk.scores;
 
         // Add chunk score to caches
         for (index_t s = 0; s != scores.size(0); s++) {
@@ -187,6 +383,15 @@ private:
         }
         //dbg(scores_cache_.size(0), scores_cache_.size(1));
 
+        stats_.num_chunks++;
+        stats_.num_frames += scores.size(0);
+        stats_.chunk_latency_ms.Add(ElapsedMs(chunk_begin));
+        stats_.encoder_forward_ms.Add(chunk.encoder_forward_ms);
+        stats_.ctc_activation_ms.Add(chunk.ctc_activation_ms);
+        if (subsampling_cache_.isTensor()) {  // [1, frames, dim]
+            stats_.cache_frames.Add(subsampling_cache_.toTensor().size(1));
+        }
+
         return Error::OK;
     }
 
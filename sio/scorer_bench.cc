@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <random>
+#include <chrono>
+#include <thread>
+
+#include "sio/scorer.h"
+
+namespace sio {
+
+// Long stream through a chunk-based streaming nnet:
+// per-chunk latency & encoder cache size are reported per time window, which should stay flat with num_left_chunks > 0
+static void BenchLongStream(torch::jit::script::Module& nnet, int feat_dim, f32 seconds, const ScorerConfig& config) {
+    Scorer scorer;
+    scorer.Load(config, nnet, feat_dim, 0);
+
+    const f32 frame_rate = 100.0;  // 10ms frame shift
+    const f32 window_seconds = 600.0;
+    const i64 num_frames = seconds * frame_rate;
+    const i64 window_frames = window_seconds * frame_rate;
+
+    std::mt19937 rng(1234);
+    std::normal_distribution<f32> normal(0.0, 1.0);  // mean-var normalized features
+    Vec<f32> feat_frame(feat_dim);
+
+    printf("chunk_size=%d num_left_chunks=%d\n", config.chunk_size, config.num_left_chunks);
+    printf("%-16s%-12s%-12s%-12s%-12s%-12s\n", "stream(min)", "chunks", "p50(ms)", "p99(ms)", "max(ms)", "cache_frames");
+    for (i64 f = 0; f != num_frames; f++) {
+        for (f32& x : feat_frame) {
+            x = normal(rng);
+        }
+        scorer.Push(feat_frame);
+        while (scorer.Size() > 0) {
+            scorer.Pop();
+        }
+
+        if ((f + 1) % window_frames == 0 || f + 1 == num_frames) {
+            const ScorerStats& s = scorer.Stats();
+            printf("%-16.0f%-12ld%-12.2f%-12.2f%-12.2f%-12.0f\n", (f + 1) / frame_rate / 60.0,
+                s.num_chunks, s.chunk_latency_ms.Quantile(0.5), s.chunk_latency_ms.Quantile(0.99),
+                s.chunk_latency_ms.Max(), s.cache_frames.Max()
+            );
+            scorer.ResetStats();
+        }
+    }
+    scorer.PushEos();
+}
+
+
+// Concurrent streaming sessions, one thread each, with & without cross-session batching.
+//   staggered = false: sessions start together, so their chunks share offsets
+//   staggered = true: session i is i chunks ahead, so offsets never match & nothing is batched,
+//     see EncoderChunk::BatchKey()
+static void BenchBatching(torch::jit::script::Module& nnet, int feat_dim, f32 seconds, const ScorerConfig& config,
+                          bool staggered) {
+    const int num_sessions = 16;
+    const i64 num_frames = seconds * 100.0;
+
+    printf("staggered=%d\n", staggered);
+    printf("%-24s%-16s%-12s%-16s%s\n", "max_batch_size", "chunks/sec", "batch(mean)", "queue_wait(p99)", "batch_size:count");
+    for (int max_batch_size : {1, 4, 16}) {
+        BatchScorerConfig batch_config;
+        batch_config.max_batch_size = max_batch_size;
+        BatchScorer batch_scorer;
+        if (max_batch_size > 1) {
+            batch_scorer.Load(batch_config, nnet);
+        }
+
+        Vec<Scorer> scorers(num_sessions);
+        for (Scorer& scorer : scorers) {
+            scorer.Load(config, nnet, feat_dim, 0, max_batch_size > 1 ? &batch_scorer : nullptr);
+        }
+
+        auto push_random_frames = [&](int i, i64 n, std::mt19937* rng) {
+            std::normal_distribution<f32> normal(0.0, 1.0);
+            Vec<f32> feat_frame(feat_dim);
+            for (i64 f = 0; f != n; f++) {
+                for (f32& x : feat_frame) {
+                    x = normal(*rng);
+                }
+                scorers[i].Push(feat_frame);
+                while (scorers[i].Size() > 0) {
+                    scorers[i].Pop();
+                }
+            }
+        };
+        const i64 chunk_frames = config.chunk_size * nnet.run_method("subsampling_rate").toInt();
+        Vec<std::mt19937> rngs;
+        for (int i = 0; i != num_sessions; i++) { // staggered pre-roll, one session at a time, excluded from stats
+            rngs.emplace_back(i);
+            if (staggered) {
+                push_random_frames(i, i * chunk_frames, &rngs[i]);
+            }
+            scorers[i].ResetStats();
+        }
+        batch_scorer.ResetStats();
+
+        auto t0 = std::chrono::steady_clock::now();
+        Vec<std::thread> threads;
+        for (int i = 0; i != num_sessions; i++) {
+            threads.emplace_back([&, i]() { push_random_frames(i, num_frames, &rngs[i]); });
+        }
+        for (std::thread& t : threads) {
+            t.join();
+        }
+        f64 elapsed = std::chrono::duration<f64>(std::chrono::steady_clock::now() - t0).count();
+
+        i64 num_chunks = 0;
+        for (const Scorer& scorer : scorers) {
+            num_chunks += scorer.Stats().num_chunks;
+        }
+        BatchScorerStats s = batch_scorer.Stats();
+        Str histogram;
+        for (int k = 0; k != s.batch_size.NumBuckets(); k++) {
+            if (s.batch_size.BucketCount(k) != 0) {  // unit-width buckets, i.e. one per batch size
+                histogram += absl::StrFormat(" %.0f:%d", s.batch_size.BucketLowerBound(k), s.batch_size.BucketCount(k));
+            }
+        }
+        printf("%-24d%-16.1f%-12.2f%-16.2f%s\n", max_batch_size, num_chunks / elapsed,
+            max_batch_size > 1 ? s.batch_size.Mean() : 1.0, s.queue_wait_ms.Quantile(0.99), histogram.c_str()
+        );
+    }
+}
+
+} // namespace sio
+
+
+// Usage: scorer_bench model.pts [seconds=3600] [chunk_size=16] [feat_dim=80]
+//   1. bounded (num_left_chunks=4) & unbounded (num_left_chunks=-1) encoder caches are compared
+//   2. 16 concurrent sessions of 60 seconds, with & without cross-session batching, started together & staggered
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s model.pts [seconds=3600] [chunk_size=16] [feat_dim=80]\n", argv[0]);
+        return 1;
+    }
+    torch::jit::script::Module nnet = torch::jit::load(argv[1]);
+    sio::f32 seconds = argc > 2 ? atof(argv[2]) : 3600.0;
+    sio::ScorerConfig config;
+    config.chunk_size = argc > 3 ? atoi(argv[3]) : 16;
+    int feat_dim = argc > 4 ? atoi(argv[4]) : 80;
+
+    for (int num_left_chunks : {4, -1}) {
+        config.num_left_chunks = num_left_chunks;
+        sio::BenchLongStream(nnet, feat_dim, seconds, config);
+    }
+
+    config.num_left_chunks = 4;
+    for (bool staggered : {false, true}) {
+        sio::BenchBatching(nnet, feat_dim, 60.0, config, staggered);
+    }
+    return 0;
+}
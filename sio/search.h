@@ -2,10 +2,21 @@
 #define SIO_SEARCH_H
 
 #include <string.h>
+#include <math.h>
 #include <limits>
+#include <algorithm>
+#include <chrono>
+#include <queue>
+
+#include "torch/torch.h"
 
 #include "sio/base.h"
+#include "sio/struct_loader.h"
+#include "sio/histogram.h"
+#include "sio/latency_stats.h"
 #include "sio/allocator.h"
+#include "sio/thread_pool.h"
+#include "sio/snapshot.h"
 #include "sio/tokenizer.h"
 #include "sio/finite_state_machine.h"
 #include "sio/language_model.h"
@@ -25,14 +36,49 @@ struct BeamSearchConfig {
 
     f32 beam = 16.0;
     i32 max_active = 12;
+    i32 histogram_bins = 0;  // > 0: max_active pruning via score histogram, otherwise via nth_element
     f32 token_set_size = 1;
 
+    // adaptive beam, > 0 to enable: beam is re-estimated after each frame from its active count & score spread,
+    // aiming at adaptive_target_active TokenSets, and narrowed further when a frame exceeds adaptive_frame_budget_ms.
+    // beam above is the upper bound then, adaptive_min_beam is the lower bound, 0 < adaptive_min_beam <= beam.
+    i32 adaptive_target_active = 0;
+    f32 adaptive_min_beam = 4.0;
+    f32 adaptive_frame_budget_ms = 0.0;  // CPU time budget per frame of the pushing thread, <= 0 to disable
+
     i32 nbest = 1;
 
+    // word lattice mode, > 0 to enable: hypotheses dropped where they meet in a TokenSet,
+    // by context recombination or token_set_size truncation, are kept as alternative arcs
+    // of the token beating them, if within lattice_beam of it.
+    // N-best is then extracted from the lattice via A*, so its width is not bound by token_set_size.
+    f32 lattice_beam = 0.0;
+    i32 lattice_nbest_max_pops = 10000;  // bounds A* cost, as many lattice paths are alignments of same labels
+
+    // CTC blank frame skipping, > 0 to enable:
+    // on frames with blank posterior above this threshold, only emitting self-loops are expanded.
+    f32 blank_skip_threshold = 0.0;
+
+    // per-frame label pre-pruning, only arcs with selected input labels are expanded:
+    //   label_topk > 0: selects k best labels of each frame
+    //   label_beam > 0: selects labels within this beam of the best label of each frame
+    i32 label_topk = 0;
+    f32 label_beam = 0.0;
+
+    // parallel emitting expansion, > 1 to enable: source TokenSets are split into shards of expansion_shard_size,
+    // workers score & beam-prune tokens of each shard, replaying the beam as serial expansion would move it,
+    // then surviving tokens are recombined on the search thread in serial order, so results are identical.
+    // Frames fall back to serial expansion if LMs aren't stateless, or frames are blank-skipped or label-pruned.
+    i32 num_expansion_threads = 1;
+    i32 expansion_shard_size = 64;
+
     f32 insertion_penalty = 0.0;
     bool apply_score_offsets = true;  // for numerical stability of long audio scores
 
     i32 token_allocator_slab_size = 4096;
+    i32 token_allocator_max_retained_slabs = 64;  // slabs kept warm across sessions
+    i32 token_set_arena_chunk_size = 16384;  // pinned TokenSets per lattice arena chunk
+    i32 token_gc_interval = 100;  // frames between token garbage collections, <= 0 to disable
 
 
     Error Register(StructLoader* loader, const std::string module = "") {
@@ -40,14 +86,33 @@ struct BeamSearchConfig {
 
         loader->AddEntry(module + ".beam", &beam);
         loader->AddEntry(module + ".max_active", &max_active);
+        loader->AddEntry(module + ".histogram_bins", &histogram_bins);
         loader->AddEntry(module + ".token_set_size", &token_set_size);
 
+        loader->AddEntry(module + ".adaptive_target_active", &adaptive_target_active);
+        loader->AddEntry(module + ".adaptive_min_beam", &adaptive_min_beam);
+        loader->AddEntry(module + ".adaptive_frame_budget_ms", &adaptive_frame_budget_ms);
+
         loader->AddEntry(module + ".nbest", &nbest);
 
+        loader->AddEntry(module + ".lattice_beam", &lattice_beam);
+        loader->AddEntry(module + ".lattice_nbest_max_pops", &lattice_nbest_max_pops);
+
+        loader->AddEntry(module + ".blank_skip_threshold", &blank_skip_threshold);
+
+        loader->AddEntry(module + ".label_topk", &label_topk);
+        loader->AddEntry(module + ".label_beam", &label_beam);
+
+        loader->AddEntry(module + ".num_expansion_threads", &num_expansion_threads);
+        loader->AddEntry(module + ".expansion_shard_size", &expansion_shard_size);
+
         loader->AddEntry(module + ".insertion_penalty", &insertion_penalty);
         loader->AddEntry(module + ".apply_score_offsets", &apply_score_offsets);
 
         loader->AddEntry(module + ".token_allocator_slab_size", &token_allocator_slab_size);
+        loader->AddEntry(module + ".token_allocator_max_retained_slabs", &token_allocator_max_retained_slabs);
+        loader->AddEntry(module + ".token_set_arena_chunk_size", &token_set_arena_chunk_size);
+        loader->AddEntry(module + ".token_gc_interval", &token_gc_interval);
 
         return Error::OK;
     }
@@ -69,73 +134,326 @@ struct BeamSearchConfig {
 
 /*
  * StateHandle represents a unique state in decoding graph during beam search.
- *
- *   For single-graph decoding: StateHandle = FsmStateId. e.g.:
- *       * T (vanilla CTC)
- *       * TLG (CTC with lexicon & external LM)
- *       * HCLG (WFST)
- *
- *   For multi-graph decoding: say StateHandle = 64-bits(32 + 32) integer:
- *       1st 32 bits represent a Fsm
- *       2nd 32 bits represent a state inside that Fsm
+ *   64-bits(32 + 32) integer:
+ *       1st 32 bits represent a graph instance, 0 -> main graph, e.g.:
+ *           * T (vanilla CTC)
+ *           * TLG (CTC with lexicon & external LM)
+ *           * HCLG (WFST)
+ *         others -> subgraphs entered via nonterminal arcs, e.g. class or sub-grammar graphs
+ *       2nd 32 bits represent a state inside that graph
  */
-using StateHandle = FsmStateId;
-//using StateHandle = u64;
+using StateHandle = u64;
 
 static inline StateHandle ComposeStateHandle(int graph, FsmStateId state) {
-    return state;
-    //return (static_cast<StateHandle>(graph) << 32) + static_cast<StateHandle>(state);
+    return (static_cast<StateHandle>(graph) << 32) + static_cast<StateHandle>(static_cast<u32>(state));
 }
 static inline int HandleToGraph(StateHandle h) {
-    return 0;
-    //return static_cast<int>(static_cast<u32>(h >> 32));
+    return static_cast<int>(static_cast<u32>(h >> 32));
 }
 static inline FsmStateId HandleToState(StateHandle h) {
-    return h;
-    //return static_cast<FsmStateId>(static_cast<u32>(h))
+    return static_cast<FsmStateId>(static_cast<u32>(h));
 }
 
 
+/*
+ * Token layout is specialized by the max number of LMs(MaxLms) at compile time,
+ * e.g. Token<1> is 40 bytes on 64-bit platforms, so more tokens fit into a cache line.
+ * TraceBack keeps graph & arc id rather than a copy of the arc, arc is looked up only on trace back.
+ */
+template <int MaxLms>
 struct Token;
-struct TokenSet;
 
+template <int MaxLms>
 struct TraceBack {
-    Token* token = nullptr;
-    FsmArc arc;
+    Token<MaxLms>* token = nullptr;
+    FsmArcId arc = kFsmNoArc; // kFsmNoArc -> initial token of a session
+    i32 graph = 0; // graph of arc, 0 -> main graph
     f32 score = 0.0;
-    LmScore lm_scores[SIO_MAX_LM] = {}; // zero initialized to 0.0
+    LmScore lm_scores[MaxLms] = {}; // zero initialized to 0.0
 };
 
 
+template <int MaxLms>
 struct Token {
     Nullable<Token*> next = nullptr; // nullptr -> last token in a TokenSet
-    //TokenSet* master = nullptr;
 
     f32 total_score = 0.0;
-    LmStateId lm_states[SIO_MAX_LM] = {}; // zero initialized to 0 
-    TraceBack trace_back;
+    LmStateId lm_states[MaxLms] = {}; // zero initialized to 0 
+    TraceBack<MaxLms> trace_back;
+};
+
+
+// Alternative incoming arc of a token in word lattice mode, i.e. a dropped hypothesis at the same TokenSet
+template <int MaxLms>
+struct LatticeArc {
+    Nullable<LatticeArc*> next = nullptr;
+    f32 total_score = 0.0;  // total score of the dropped hypothesis
+    TraceBack<MaxLms> trace_back;
 };
 
 
 // TokenSet represents a location(time, state handle) in beam search space (sometimes called trellis space),
 // Each TokenSet holds a list of tokens representing search hypotheses
+template <int MaxLms>
 struct TokenSet {
-    Nullable<Token*> head = nullptr; // nullptr -> TokenSet pruned or inactive
+    Nullable<Token<MaxLms>*> head = nullptr; // nullptr -> TokenSet pruned or inactive
 
     f32 best_score = std::numeric_limits<f32>::lowest();
     int time = 0;
     StateHandle handle = 0;
 };
 
-static inline bool TokenSetBetterThan(const TokenSet& x, const TokenSet& y) {
+// A graph instance is a graph entered from a specific parent location of multi-graph decoding,
+// so a subgraph entered from different places results in different search states.
+// Instances are created on the fly and indexed by the 1st half of StateHandle.
+struct GraphInstance {
+    int graph = 0;                // index of graphs, 0 -> main graph
+    int parent = -1;              // parent instance, -1 -> main graph instance
+    FsmStateId return_state = 0;  // parent state to return to
+
+    GraphInstance() = default;
+    GraphInstance(int graph, int parent, FsmStateId return_state) :
+        graph(graph), parent(parent), return_state(return_state) { }
+};
+
+
+// Pointer-free encoding of search states for BeamSearch::Snapshot(), pointers are indexes of written tokens
+template <int MaxLms>
+struct PackedTraceBack {
+    i32 token;  // -1 -> nullptr
+    FsmArcId arc;
+    i32 graph;
+    f32 score;
+    LmScore lm_scores[MaxLms];
+};
+
+template <int MaxLms>
+struct PackedToken {
+    f32 total_score;
+    LmStateId lm_states[MaxLms];
+    PackedTraceBack<MaxLms> trace_back;
+};
+
+struct PackedTokenSet {
+    StateHandle handle;
+    f32 best_score;
+    i32 num_tokens;
+};
+
+template <int MaxLms>
+struct PackedLatticeArc {
+    i32 owner;
+    f32 total_score;
+    PackedTraceBack<MaxLms> trace_back;
+};
+
+
+template <int MaxLms>
+static inline bool TokenSetBetterThan(const TokenSet<MaxLms>& x, const TokenSet<MaxLms>& y) {
     return (x.best_score != y.best_score) ? (x.best_score > y.best_score) : (x.handle < y.handle);
 }
 
 
+/*
+ * max_active pruning:
+ *   partitions token sets in place so that the best max_active ones come first,
+ *   returns the worst survivor, i.e. (*token_sets)[max_active - 1].
+ */
+template <int MaxLms>
+static inline const TokenSet<MaxLms>& NthElementPrune(Vec<TokenSet<MaxLms>>* token_sets, int max_active) {
+    SIO_CHECK(max_active > 0 && max_active <= token_sets->size());
+    auto nth = token_sets->begin() + max_active - 1;
+    std::nth_element(token_sets->begin(), nth, token_sets->end(), TokenSetBetterThan<MaxLms>);
+    return *nth;
+}
+
+
+/*
+ * Same result as NthElementPrune(), via a score histogram:
+ *   1. bins best scores of (max_score - beam, max_score] into histogram->size() bins,
+ *      then locates the bin where the max_active-th best TokenSet falls into.
+ *   2. partitions token sets in place: [above that bin | inside that bin | below that bin]
+ *   3. nth_element() is only needed inside that bin, which is normally small.
+ * Scores below (max_score - beam) all go to the last bin.
+ */
+template <int MaxLms>
+static inline const TokenSet<MaxLms>& HistogramPrune(
+    Vec<TokenSet<MaxLms>>* token_sets, int max_active, f32 max_score, f32 beam, Vec<int>* histogram
+) {
+    SIO_CHECK(max_active > 0 && max_active <= token_sets->size());
+    SIO_CHECK(!histogram->empty());
+    SIO_CHECK_GT(beam, 0.0);
+
+    int num_bins = histogram->size();
+    f32 scale = num_bins / beam;
+    auto bin_of = [=](const TokenSet<MaxLms>& ts) {
+        f32 x = (max_score - ts.best_score) * scale;
+        return x < 0.0f ? 0 : x >= num_bins ? num_bins - 1 : static_cast<int>(x);
+    };
+
+    std::fill(histogram->begin(), histogram->end(), 0);
+    for (const auto& ts : *token_sets) {
+        (*histogram)[bin_of(ts)]++;
+    }
+
+    int b = 0;
+    int num_above = 0; // num of token sets in bins [0, b)
+    while (num_above + (*histogram)[b] < max_active) {
+        num_above += (*histogram)[b++];
+    }
+
+    auto inside = std::partition(token_sets->begin(), token_sets->end(),
+        [&](const TokenSet<MaxLms>& ts) { return bin_of(ts) < b; }
+    );
+    auto below = std::partition(inside, token_sets->end(),
+        [&](const TokenSet<MaxLms>& ts) { return bin_of(ts) == b; }
+    );
+
+    auto nth = token_sets->begin() + max_active - 1;
+    std::nth_element(inside, nth, below, TokenSetBetterThan<MaxLms>);
+    return *nth;
+}
+
+
+/*
+ * Search statistics of one session, or aggregated over many sessions via Merge(),
+ * e.g. for tuning beam & max_active against cost.
+ *   counters: accumulated over all frames
+ *   histograms: sampled once per frame, except traceback_ms once per session
+ */
+struct SearchStats {
+    i64 num_sessions = 0;
+    i64 num_frames = 0;
+    i64 num_tokens_created = 0;
+    i64 num_tokens_recombined = 0;  // tokens dropped by context recombination
+    i64 num_arcs_visited = 0;
+    i64 num_lm_calls = 0;
+    i64 num_blank_skipped_frames = 0;
+    i64 num_parallel_frames = 0;  // frames expanded by parallel emitting expansion
+    i64 num_batched_frames = 0;  // frames expanded by shared emitting expansion of BatchBeamSearch
+    i64 num_gc = 0;
+    i64 num_gc_reclaimed_tokens = 0;
+    i64 num_lattice_arcs = 0;  // alternative arcs added in word lattice mode
+
+    Histogram active_token_sets = Histogram::Exponential(1.0, 2.0, 16);  // after pruning
+    Histogram tokens_created = Histogram::Exponential(1.0, 2.0, 24);
+    Histogram arcs_visited = Histogram::Exponential(1.0, 2.0, 24);
+    Histogram effective_beam = Histogram::Linear(0.0, 32.0, 64);  // score range kept after pruning
+    Histogram retained_slabs = Histogram::Exponential(1.0, 2.0, 16);  // token slabs allocated, in use or idle
+
+    // stage wall time, layouts match LatencyStats, into which they are gathered
+    Histogram expand_ms = Histogram::Exponential(0.01, 1.25, 48);  // emitting & epsilon expansion
+    Histogram prune_ms = Histogram::Exponential(0.01, 1.25, 48);  // prune & pin down
+    Histogram traceback_ms = Histogram::Exponential(0.01, 1.25, 48);  // eos expansion & nbest
+
+
+    void Merge(const SearchStats& other) {
+        num_sessions += other.num_sessions;
+        num_frames += other.num_frames;
+        num_tokens_created += other.num_tokens_created;
+        num_tokens_recombined += other.num_tokens_recombined;
+        num_arcs_visited += other.num_arcs_visited;
+        num_lm_calls += other.num_lm_calls;
+        num_blank_skipped_frames += other.num_blank_skipped_frames;
+        num_parallel_frames += other.num_parallel_frames;
+        num_batched_frames += other.num_batched_frames;
+        num_gc += other.num_gc;
+        num_gc_reclaimed_tokens += other.num_gc_reclaimed_tokens;
+        num_lattice_arcs += other.num_lattice_arcs;
+
+        active_token_sets.Merge(other.active_token_sets);
+        tokens_created.Merge(other.tokens_created);
+        arcs_visited.Merge(other.arcs_visited);
+        effective_beam.Merge(other.effective_beam);
+        retained_slabs.Merge(other.retained_slabs);
+        expand_ms.Merge(other.expand_ms);
+        prune_ms.Merge(other.prune_ms);
+        traceback_ms.Merge(other.traceback_ms);
+    }
+
+
+    void Reset() {
+        num_sessions = 0;
+        num_frames = 0;
+        num_tokens_created = 0;
+        num_tokens_recombined = 0;
+        num_arcs_visited = 0;
+        num_lm_calls = 0;
+        num_blank_skipped_frames = 0;
+        num_parallel_frames = 0;
+        num_batched_frames = 0;
+        num_gc = 0;
+        num_gc_reclaimed_tokens = 0;
+        num_lattice_arcs = 0;
+
+        active_token_sets.Reset();
+        tokens_created.Reset();
+        arcs_visited.Reset();
+        effective_beam.Reset();
+        retained_slabs.Reset();
+        expand_ms.Reset();
+        prune_ms.Reset();
+        traceback_ms.Reset();
+    }
+
+
+    Str Report() const {
+        auto summary = [](const char* name, const Histogram& h) {
+            return absl::StrFormat("  %-20s mean:%10.2f  p50:%10.2f  p90:%10.2f  p99:%10.2f  max:%10.2f\n",
+                name, h.Mean(), h.Quantile(0.5), h.Quantile(0.9), h.Quantile(0.99), h.Max()
+            );
+        };
+
+        Str r = absl::StrFormat(
+            "sessions:%d frames:%d tokens_created:%d tokens_recombined:%d arcs_visited:%d "
+            "lm_calls:%d blank_skipped_frames:%d parallel_frames:%d batched_frames:%d "
+            "gc:%d gc_reclaimed_tokens:%d lattice_arcs:%d\n",
+            num_sessions, num_frames, num_tokens_created, num_tokens_recombined, num_arcs_visited,
+            num_lm_calls, num_blank_skipped_frames, num_parallel_frames, num_batched_frames,
+            num_gc, num_gc_reclaimed_tokens, num_lattice_arcs
+        );
+        r += summary("active_token_sets", active_token_sets);
+        r += summary("tokens_created", tokens_created);
+        r += summary("arcs_visited", arcs_visited);
+        r += summary("effective_beam", effective_beam);
+        r += summary("retained_slabs", retained_slabs);
+        r += summary("expand_ms", expand_ms);
+        r += summary("prune_ms", prune_ms);
+        r += summary("traceback_ms", traceback_ms);
+        return r;
+    }
+};
+
+
+template <int MaxLms>
+class BatchBeamSearch;
+
+
+template <int MaxLms = 1>
 class BeamSearch {
+    static_assert(MaxLms >= 1 && MaxLms <= SIO_MAX_LM, "unsupported number of LMs");
+    friend class BatchBeamSearch<MaxLms>;  // shares emitting expansion among sessions
+    using Token = sio::Token<MaxLms>;
+    using TokenSet = sio::TokenSet<MaxLms>;
+    using LatticeArc = sio::LatticeArc<MaxLms>;
+    using PackedTraceBack = sio::PackedTraceBack<MaxLms>;
+    using PackedToken = sio::PackedToken<MaxLms>;
+    using PackedLatticeArc = sio::PackedLatticeArc<MaxLms>;
+
     BeamSearchConfig config_;
-    const Fsm* graph_ = nullptr;
+    const Fsm* graph_ = nullptr;  // main graph
     const Tokenizer* tokenizer_ = nullptr;
+
+    // multi-graph decoding:
+    //   graphs_[0] is the main graph, others are subgraphs registered via SetSubgraph().
+    //   A subgraph is entered via nonterminal arcs (epsilon input, nonterminal output) of its parent,
+    //   and returns to the destination state of that nonterminal arc via its own kFsmInputEnd arcs.
+    //   Both entering & returning arcs consume no frame and output nothing.
+    Vec<const Fsm*> graphs_;
+    FastMap<FsmLabel, int> subgraphs_;  // nonterminal -> index of graphs_
+
+    Vec<GraphInstance> instances_;
+    FastMap<std::tuple<int, int, FsmStateId>, int> instance_map_;
     Vec<Unique<LanguageModel*>> lms_;
 
     Str session_key_ = "default_session";
@@ -146,23 +464,85 @@ class BeamSearch {
     // invariant of time & frame indexing:
     //   {time=k} ---[frame=k]---> {time=k+1}
     // where: k ~ [0, total_frames)
-    Vec<Vec<TokenSet>> lattice_;
+    // notes: token GC drops all pinned frames, right before the latest one is pinned,
+    //   so lattice_.back() is always the latest frame, lattice_[k] is time k only without GC.
+    // TokenSets of pinned frames are stored in token_set_arena_, each frame is a span of it.
+    Vec<Span<TokenSet>> lattice_;
+    ChunkedArena<TokenSet> token_set_arena_;
     SlabAllocator<Token> token_allocator_;
 
+    // token garbage collection
+    //   detached_tokens_: tokens no longer owned by any TokenSet of lattice_,
+    //     e.g. tokens of pruned TokenSets & tokens survived previous GC, chained via Token::next
+    Nullable<Token*> detached_tokens_ = nullptr;
+    FastSet<const Token*> gc_marks_;
+    Vec<const Token*> gc_stack_;
+
+    // word lattice mode: token -> its alternative incoming arcs, chained via LatticeArc::next
+    FastMap<const Token*, LatticeArc*> alternatives_;
+    SlabAllocator<LatticeArc> lattice_arc_allocator_;
+
     // search frontier
     int cur_time_ = 0;  // frontier location on time axis
     Vec<TokenSet> frontier_;
     FastMap<StateHandle, int> frontier_map_;  // search state handle -> token set index in frontier
     Vec<int> eps_queue_;
+    Vec<int> histogram_;
+
+    // blank frame skipping
+    Vec<Vec<FsmArcId>> self_loops_;  // [graph, state] -> emitting self-loop arc, kFsmNoArc if none
+    f32 blank_skip_score_ = 0.0;
+
+    // label pre-pruning
+    Vec<FsmLabel> labels_;      // selected labels of current frame, in ascending order
+    Vec<bool> label_selected_;  // label -> selected by current frame
+
+    // parallel emitting expansion, see FrontierExpandEmittingParallel()
+    struct ExpansionShard {
+        Vec<f32> records;  // pass 1: token scores lifting the beam, from the shard's own beginning
+        f32 score_max = 0.0;  // beam of the shard, pass 2 starts from beam at shard begin in serial order
+        f32 score_cutoff = 0.0;
+        struct PassedArc {
+            int src;  // index of lattice_.back()
+            const FsmArc* arc;
+            int tokens_end;  // tokens of this arc end here, begin where previous arc's end
+        };
+        Vec<PassedArc> arcs;  // pass 2: arcs passing beam
+        Vec<Token> tokens;  // pass 2: tokens surviving beam, not allocated yet
+        i64 num_arcs_visited = 0;
+        i64 num_lm_calls = 0;
+    };
+    Unique<ThreadPool*> expansion_pool_;
+    Vec<ExpansionShard> shards_;
 
     // beam
     f32 score_max_ = 0.0;
     f32 score_cutoff_ = 0.0;
+    f32 beam_ = 0.0;  // config_.beam, or adapted per frame in adaptive mode
+
+    // adaptive beam inputs of current frame, see AdaptBeam()
+    i64 frame_num_candidates_ = 0;  // frontier size before max_active pruning
+    f32 frame_score_spread_ = 0.0;  // best - worst score of those candidates
+    f64 frame_begin_cpu_ms_ = 0.0;
 
     Vec<f32> score_offsets_;  // keep hypotheses scores in a good dynamic range
 
     Vec<Vec<TokenId>> nbest_;
 
+    // partial result
+    //   stable_token_: latest common ancestor of all surviving tokens,
+    //     so path up to it won't change anymore and is never traced back again.
+    Nullable<const Token*> stable_token_ = nullptr;
+    Vec<TokenId> stable_prefix_;  // output labels of path up to stable_token_
+    Vec<TokenId> partial_;
+    Vec<const Token*> best_chain_;
+    FastMap<const Token*, int> meet_index_;  // token -> index of best_chain_ where its trace back meets
+
+    // statistics of current(or latest) session, kept until next session begins
+    SearchStats stats_;
+    i64 frame_tokens_created_ = 0;  // stats_.num_tokens_created at current frame begin
+    i64 frame_arcs_visited_ = 0;
+
 public:
 
     Error Load(const BeamSearchConfig& config, const Fsm& graph, const Tokenizer& tokenizer) {
@@ -173,11 +553,36 @@ public:
         SIO_CHECK(graph_ == nullptr);
         graph_ = &graph;
 
+        SIO_CHECK(graphs_.empty());
+        graphs_.push_back(graph_);
+
         SIO_CHECK(tokenizer_ == nullptr);
         tokenizer_ = &tokenizer;
 
         SIO_CHECK(lms_.empty());
         lms_.push_back(std::make_unique<PrefixTreeLm>());
+        SIO_CHECK_LE(lms_.size(), MaxLms);
+
+        if (config_.blank_skip_threshold > 0.0) {
+            SIO_CHECK_LE(config_.blank_skip_threshold, 1.0);
+            blank_skip_score_ = log(config_.blank_skip_threshold); // scores are log posteriors
+        }
+        self_loops_.resize(1);
+        BuildSelfLoops(*graph_, &self_loops_[0]);
+
+        if (config_.adaptive_target_active > 0) {  // beam_ stays within [adaptive_min_beam, beam]
+            SIO_CHECK_GT(config_.adaptive_min_beam, 0.0);
+            SIO_CHECK_LE(config_.adaptive_min_beam, config_.beam);
+        }
+
+        if (config_.num_expansion_threads > 1) {
+            SIO_CHECK_GT(config_.expansion_shard_size, 0);
+            expansion_pool_ = std::make_unique<ThreadPool>(config_.num_expansion_threads);
+        }
+
+        token_allocator_.SetSlabSize(config_.token_allocator_slab_size);
+        lattice_arc_allocator_.SetSlabSize(config_.token_allocator_slab_size);
+        token_set_arena_.SetChunkSize(config_.token_set_arena_chunk_size);
 
         status_ = SearchStatus::kIdle;
 
@@ -185,24 +590,53 @@ public:
     }
 
 
+    // Appends an LM after the built-in prefix tree LM, word-end arcs are scored by all LMs & summed.
+    // Only allowed between sessions, at most MaxLms LMs in total.
+    Error AddLm(Unique<LanguageModel*> lm) {
+        SIO_CHECK(status_ == SearchStatus::kIdle);
+        SIO_CHECK(lm != nullptr);
+        SIO_CHECK_LT(lms_.size(), MaxLms);
+        lms_.push_back(std::move(lm));
+        return Error::OK;
+    }
+
+
+    // Registers a subgraph entered via nonterminal arcs, or hot-switches a registered one,
+    // so small dynamic grammars can be updated without reloading the main graph.
+    //   nonterminal: output label of nonterminal arcs, should not be a regular output label.
+    //   Only allowed between sessions, graph should outlive its use in this search.
+    // Recursive grammars are fine, as long as a subgraph can't re-enter itself without consuming frames.
+    Error SetSubgraph(FsmLabel nonterminal, const Fsm& graph) {
+        SIO_CHECK(status_ == SearchStatus::kIdle);
+        SIO_CHECK(!graph.Empty());
+        SIO_CHECK(nonterminal != kFsmEpsilon && nonterminal != kFsmInputEnd);
+
+        auto res = subgraphs_.try_emplace(nonterminal, graphs_.size());
+        int g = res.first->second;
+        if (res.second) {
+            graphs_.push_back(&graph);
+            self_loops_.emplace_back();
+        } else {
+            graphs_[g] = &graph;
+        }
+        BuildSelfLoops(graph, &self_loops_[g]);
+
+        return Error::OK;
+    }
+
+
     Error Push(const torch::Tensor score) {
         SIO_CHECK_EQ(score.dim(), 1); // should be one frame per each Push() call site
+        return Push(score.data_ptr<float>());
+    }
 
-        SIO_CHECK(status_ == SearchStatus::kIdle || status_ == SearchStatus::kBusy);
-        if (status_ == SearchStatus::kIdle) {
-            InitSession();
-            OnSessionBegin();
-        }
-        SIO_CHECK(status_ == SearchStatus::kBusy);
 
-        OnFrameBegin();
-        {
-            FrontierExpandEmitting(score.data_ptr<float>());
-            FrontierExpandEpsilon();
-            FrontierPrune();
-            FrontierPinDown();
-        }
-        OnFrameEnd();
+    // frame_score: scores of one frame, indexed by graph input label
+    Error Push(const f32* frame_score) {
+        BeginFrame();
+        auto emitting_begin = std::chrono::steady_clock::now();
+        FrontierExpandEmitting(frame_score);
+        EndFrame(ElapsedMs(emitting_begin));
 
         return Error::OK;
     }
@@ -210,8 +644,10 @@ public:
 
     Error PushEos() {
         SIO_CHECK(status_ == SearchStatus::kBusy);
+        auto traceback_begin = std::chrono::steady_clock::now();
         ExpandFrontierEos();
         TraceBestPath();
+        stats_.traceback_ms.Add(ElapsedMs(traceback_begin));
         SIO_CHECK(status_ == SearchStatus::kDone);
 
         OnSessionEnd();
@@ -225,18 +661,444 @@ public:
     }
 
 
+    // Partial result of current best path during streaming,
+    // leading NumStableTokens() tokens are shared by all surviving hypotheses.
+    const Vec<TokenId>& PartialResult() {
+        partial_.clear();
+        if (status_ != SearchStatus::kBusy) {
+            return partial_;
+        }
+
+        UpdateStablePrefix();
+
+        partial_ = stable_prefix_;
+        for (int i = best_chain_.size() - 1; i >= 0; i--) {
+            FsmLabel olabel = OutputLabel(*best_chain_[i]);
+            if (olabel != kFsmEpsilon) {
+                partial_.push_back(olabel);
+            }
+        }
+
+        return partial_;
+    }
+
+
+    size_t NumStableTokens() const { return stable_prefix_.size(); }
+
+
+    // Trailing blank frames of current best path, for endpointing.
+    //   *decoded_anything: whether best path consumes any non-blank frame.
+    // Trace back stops at the latest non-blank frame, so cost is bounded by trailing blank length,
+    // or by session length if nothing is decoded yet.
+    int TrailingBlankFrames(bool* decoded_anything) const {
+        *decoded_anything = false;
+        if (status_ != SearchStatus::kBusy || lattice_.back().empty()) {
+            return 0;
+        }
+
+        int n = 0;
+        const Token* best = lattice_.back().front().head; // FrontierPrune() puts best TokenSet first
+        for (const Token* t = best; t != nullptr; t = t->trace_back.token) {
+            const TraceBack<MaxLms>& tb = t->trace_back;
+            if (tb.arc == kFsmNoArc) {
+                break;
+            }
+            FsmLabel ilabel = graphs_[tb.graph]->arcs[tb.arc].ilabel;
+            if (ilabel == tokenizer_->blk) {
+                n++;
+            } else if (ilabel != kFsmEpsilon && ilabel != kFsmInputEnd) {
+                *decoded_anything = true;
+                break;
+            }
+        }
+        return n;
+    }
+
+
+    // Number of frames pushed in current session
+    int NumFrames() const { return cur_time_; }
+
+
+    const SearchStats& Stats() const { return stats_; }
+    size_t NumLiveTokens() const { return token_allocator_.NumUsed(); }
+    f32 Beam() const { return beam_; }  // beam applied to next frame
+
+
+    // Ends current session, an unfinished one is discarded, e.g. after it's handed over via Snapshot()
     Error Reset() {
-        SIO_CHECK(status_ == SearchStatus::kDone);
+        SIO_CHECK(status_ == SearchStatus::kDone || status_ == SearchStatus::kBusy);
         DeinitSession();
         SIO_CHECK(status_ == SearchStatus::kIdle);
 
         return Error::OK; 
     }
 
+
+    // Session handover between frames, restored search continues exactly as the original one:
+    //   1. only tokens reachable from the latest frame are written, i.e. the lattice as if GC just ran,
+    //      in lattice mode alternatives are further pruned by lattice_beam, see SnapshotPrunedLattice().
+    //      token pointers are written as indexes of written tokens.
+    //   2. LMs write their own state tables if LmStateIds are instance specific.
+    //   3. search statistics are not written, they start over in restored search.
+    // Both sides should be loaded with the same config, graphs & LMs.
+    Error Snapshot(SnapshotWriter* w) const {
+        SIO_CHECK(status_ == SearchStatus::kIdle || status_ == SearchStatus::kBusy);
+        SIO_CHECK(frontier_.empty());
+
+        w->PutTag("SRCH");
+        WriteSnapshotLayout(w);
+        w->Put<u8>(status_ == SearchStatus::kBusy);
+        if (status_ != SearchStatus::kBusy) {
+            return Error::OK;
+        }
+
+        w->Put<i32>(cur_time_);
+        w->Put<f32>(beam_);
+        w->Put<f32>(score_max_);
+        w->Put<f32>(score_cutoff_);
+        w->Put<f32>(config_.apply_score_offsets ? score_offsets_.back() : 0.0f);
+        w->PutVec(instances_);
+
+        // reachable tokens, latest frame first, see SnapshotPrunedLattice()
+        Vec<const Token*> tokens;
+        Vec<f32> deficits;
+        FastMap<const Token*, i32> index;
+        SnapshotPrunedLattice(&tokens, &deficits, &index);
+        auto index_of = [&](const Token* t) { return t == nullptr ? -1 : index.at(t); };
+        auto pack = [&](const TraceBack<MaxLms>& tb) {
+            PackedTraceBack x;
+            x.token = index_of(tb.token);
+            x.arc = tb.arc;
+            x.graph = tb.graph;
+            x.score = tb.score;
+            memcpy(x.lm_scores, tb.lm_scores, sizeof(x.lm_scores));
+            return x;
+        };
+
+        Vec<PackedToken> packed_tokens(tokens.size());
+        for (int k = 0; k != tokens.size(); k++) {
+            PackedToken& x = packed_tokens[k];
+            x.total_score = tokens[k]->total_score;
+            memcpy(x.lm_states, tokens[k]->lm_states, sizeof(x.lm_states));
+            x.trace_back = pack(tokens[k]->trace_back);
+        }
+        w->PutVec(packed_tokens);
+
+        Vec<PackedTokenSet> token_sets;
+        Vec<i32> token_set_tokens;
+        for (const TokenSet& ts : lattice_.back()) {
+            PackedTokenSet x;
+            x.handle = ts.handle;
+            x.best_score = ts.best_score;
+            x.num_tokens = 0;
+            for (const Token* t = ts.head; t != nullptr; t = t->next, x.num_tokens++) {
+                token_set_tokens.push_back(index_of(t));
+            }
+            token_sets.push_back(x);
+        }
+        w->PutVec(token_sets);
+        w->PutVec(token_set_tokens);
+
+        Vec<PackedLatticeArc> lattice_arcs;
+        for (int k = 0; k != tokens.size(); k++) {
+            auto it = alternatives_.find(tokens[k]);
+            if (it != alternatives_.end()) {
+                for (const LatticeArc* a = it->second; a != nullptr; a = a->next) {
+                    if (deficits[k] + tokens[k]->total_score - a->total_score <= config_.lattice_beam) {
+                        lattice_arcs.push_back({k, a->total_score, pack(a->trace_back)});
+                    }
+                }
+            }
+        }
+        w->PutVec(lattice_arcs);
+
+        w->Put<i32>(stable_token_ == nullptr ? -1 : index_of(stable_token_));
+        w->PutVec(stable_prefix_);
+
+        for (const auto& lm : lms_) {
+            lm->Snapshot(w);
+        }
+
+        return Error::OK;
+    }
+
+
+    // Restores a session written by Snapshot(), search should be idle and stays idle on failure
+    Error Restore(SnapshotReader* r) {
+        SIO_CHECK(status_ == SearchStatus::kIdle);
+        Error err = RestoreSession(r);
+        if (err != Error::OK) {
+            DeinitSession();
+        }
+        return err;
+    }
+
 private:
 
+    Error RestoreSession(SnapshotReader* r) {
+        SIO_SNAPSHOT_GET(r->ExpectTag("SRCH"));
+        SIO_SNAPSHOT_GET(ReadSnapshotLayout(r));
+        u8 busy = 0;
+        SIO_SNAPSHOT_GET(r->Get(&busy));
+        if (!busy) {
+            return Error::OK;
+        }
+
+        f32 score_offset = 0.0;
+        SIO_SNAPSHOT_GET(r->Get(&cur_time_));
+        SIO_SNAPSHOT_GET(r->Get(&beam_));
+        SIO_SNAPSHOT_GET(r->Get(&score_max_));
+        SIO_SNAPSHOT_GET(r->Get(&score_cutoff_));
+        SIO_SNAPSHOT_GET(r->Get(&score_offset));
+        SIO_SNAPSHOT_GET(r->GetVec(&instances_));
+
+        Vec<PackedToken> packed_tokens;
+        Vec<PackedTokenSet> token_sets;
+        Vec<i32> token_set_tokens;
+        Vec<PackedLatticeArc> lattice_arcs;
+        i32 stable_token = -1;
+        SIO_SNAPSHOT_GET(r->GetVec(&packed_tokens));
+        SIO_SNAPSHOT_GET(r->GetVec(&token_sets));
+        SIO_SNAPSHOT_GET(r->GetVec(&token_set_tokens));
+        SIO_SNAPSHOT_GET(r->GetVec(&lattice_arcs));
+        SIO_SNAPSHOT_GET(r->Get(&stable_token));
+        SIO_SNAPSHOT_GET(r->GetVec(&stable_prefix_));
+
+        // all indexes are validated before any allocation, so a corrupt snapshot can't lead to
+        // out-of-bounds graph reads or cyclic token chains later on:
+        // tokens are written successors first, so a trace back of token k must point to -1 or an index > k.
+        i32 num_tokens = packed_tokens.size();
+        auto valid = [=](i32 k) { return k >= -1 && k < num_tokens; };
+        auto valid_trace_back = [&](i32 k, const PackedTraceBack& x) {
+            if (!valid(x.token) || (x.token != -1 && x.token <= k)) return false;
+            if (x.arc == kFsmNoArc) return true; // initial token
+            return x.graph >= 0 && x.graph < graphs_.size() && x.arc >= 0 && x.arc < graphs_[x.graph]->num_arcs;
+        };
+        bool ok = valid(stable_token) && !instances_.empty();
+        for (int k = 0; k != instances_.size(); k++) {
+            const GraphInstance& x = instances_[k];
+            ok = ok && x.graph >= 0 && x.graph < graphs_.size() && x.parent >= -1 && x.parent < k
+                && (x.parent == -1 || x.return_state < graphs_[instances_[x.parent].graph]->num_states);
+        }
+        for (int k = 0; k != num_tokens; k++) {
+            ok = ok && valid_trace_back(k, packed_tokens[k].trace_back) && std::isfinite(packed_tokens[k].total_score);
+        }
+        for (const PackedLatticeArc& x : lattice_arcs) ok = ok && x.owner >= 0 && valid(x.owner) && valid_trace_back(x.owner, x.trace_back);
+        // scores are checked against search invariants, e.g. TokenSet best score is the best score of its tokens
+        f32 best_score = -std::numeric_limits<f32>::infinity();
+        Vec<bool> in_token_set(num_tokens, false);  // a token belongs to at most one TokenSet
+        const i32* p = token_set_tokens.data();
+        const i32* end = p + token_set_tokens.size();
+        for (const PackedTokenSet& x : token_sets) {
+            int i = HandleToGraph(x.handle);
+            FsmStateId state = HandleToState(x.handle);
+            ok = ok && x.num_tokens > 0 && x.num_tokens <= end - p && i >= 0 && i < instances_.size()
+                && state >= 0 && state < graphs_[instances_[i].graph]->num_states;
+            f32 best_token_score = -std::numeric_limits<f32>::infinity();
+            for (int j = 0; ok && j != x.num_tokens; j++, p++) {
+                ok = valid(*p) && *p >= 0 && !in_token_set[*p];
+                if (ok) {
+                    in_token_set[*p] = true;
+                    best_token_score = std::max(best_token_score, packed_tokens[*p].total_score);
+                }
+            }
+            ok = ok && x.best_score == best_token_score;
+            best_score = std::max(best_score, x.best_score);
+        }
+        ok = ok && p == end && !token_sets.empty() && score_max_ == best_score && score_cutoff_ <= score_max_
+            && std::isfinite(score_cutoff_) && beam_ > 0.0;
+        for (TokenId t : stable_prefix_) ok = ok && t >= 0 && t < tokenizer_->Size();
+        if (!ok) {
+            return Error::InvalidSnapshot;
+        }
+
+        stats_.Reset();
+        stats_.num_sessions = 1;
+
+        Vec<Token*> tokens(num_tokens);
+        for (Token*& t : tokens) {
+            t = token_allocator_.Alloc();
+            new (t) Token();
+        }
+        auto unpack = [&](const PackedTraceBack& x, TraceBack<MaxLms>* tb) {
+            tb->token = (x.token == -1) ? nullptr : tokens[x.token];
+            tb->arc = x.arc;
+            tb->graph = x.graph;
+            tb->score = x.score;
+            memcpy(tb->lm_scores, x.lm_scores, sizeof(x.lm_scores));
+        };
+        for (int k = 0; k != num_tokens; k++) {
+            tokens[k]->total_score = packed_tokens[k].total_score;
+            memcpy(tokens[k]->lm_states, packed_tokens[k].lm_states, sizeof(packed_tokens[k].lm_states));
+            unpack(packed_tokens[k].trace_back, &tokens[k]->trace_back);
+        }
+
+        // tokens of latest frame are chained in their TokenSets, others are detached as after GC
+        p = token_set_tokens.data();
+        for (const PackedTokenSet& x : token_sets) {
+            TokenSet ts;
+            ts.handle = x.handle;
+            ts.best_score = x.best_score;
+            ts.time = cur_time_;
+            Token** tail = &ts.head;
+            for (int i = 0; i != x.num_tokens; i++, p++) {
+                *tail = tokens[*p];
+                tail = &(*tail)->next;
+            }
+            frontier_.push_back(ts);
+        }
+        for (int k = 0; k != num_tokens; k++) {
+            if (!in_token_set[k]) {
+                DetachToken(tokens[k]);
+            }
+        }
+        lattice_.push_back(token_set_arena_.Append(frontier_.data(), frontier_.size()));
+        frontier_.clear();
+
+        for (auto x = lattice_arcs.rbegin(); x != lattice_arcs.rend(); ++x) {  // pushed front, so in reverse
+            LatticeArc* a = lattice_arc_allocator_.Alloc();
+            new (a) LatticeArc();
+            a->total_score = x->total_score;
+            unpack(x->trace_back, &a->trace_back);
+
+            LatticeArc*& head = alternatives_[tokens[x->owner]];
+            a->next = head;
+            head = a;
+        }
+
+        for (int k = 1; k < instances_.size(); k++) {  // main graph instance isn't indexed, see InitSession()
+            const GraphInstance& x = instances_[k];
+            instance_map_.emplace(std::make_tuple(x.graph, x.parent, x.return_state), k);
+        }
+
+        if (config_.apply_score_offsets) {
+            score_offsets_.push_back(score_offset);
+        }
+        stable_token_ = (stable_token == -1) ? nullptr : tokens[stable_token];
+
+        status_ = SearchStatus::kBusy;
+        for (const auto& lm : lms_) {
+            SIO_SNAPSHOT_GET(lm->Restore(r));
+        }
+
+        return Error::OK;
+    }
+
+
+    // Lattice pruning as in Kaldi's lattice-beam, alternatives only exist in lattice mode:
+    //   deficit of a token is its best score shortfall to the best path through the same latest frame token,
+    //   alternatives with deficit beyond lattice_beam can't be within lattice_beam of any final path, so dropped.
+    // Tokens are visited in reverse topological order (successors first) via DFS post order,
+    // *tokens are those reachable through kept arcs, with their *deficits & *index.
+    void SnapshotPrunedLattice(Vec<const Token*>* tokens, Vec<f32>* deficits, FastMap<const Token*, i32>* index) const {
+        auto alternatives_of = [this](const Token* t) {
+            auto it = alternatives_.find(t);
+            return it == alternatives_.end() ? static_cast<const LatticeArc*>(nullptr) : it->second;
+        };
+        auto predecessor = [](const Token* t, const LatticeArc* a) { return a == nullptr ? t->trace_back.token : a->trace_back.token; };
+
+        struct Visit {
+            const Token* token;
+            const LatticeArc* next;  // next alternative to visit, best arc is visited first
+            bool best_arc_visited;
+        };
+        FastMap<const Token*, i32>& post_index = *index;  // post order index, then index of *tokens once written
+        post_index.clear();
+        post_index.reserve(token_allocator_.NumUsed());
+        Vec<const Token*> post_order;
+        Vec<Visit> stack;
+        auto discover = [&](const Token* t) {
+            if (t != nullptr && post_index.emplace(t, -1).second) {
+                stack.push_back({t, alternatives_of(t), false});
+            }
+        };
+        for (const TokenSet& ts : lattice_.back()) {
+            for (const Token* t = ts.head; t != nullptr; t = t->next) {
+                discover(t);
+                while (!stack.empty()) {
+                    Visit& v = stack.back();
+                    if (!v.best_arc_visited) {
+                        v.best_arc_visited = true;
+                        discover(predecessor(v.token, nullptr));
+                    } else if (v.next != nullptr) {
+                        const LatticeArc* a = v.next;
+                        v.next = a->next;
+                        discover(predecessor(v.token, a));
+                    } else {
+                        post_index[v.token] = post_order.size();
+                        post_order.push_back(v.token);
+                        stack.pop_back();
+                    }
+                }
+            }
+        }
+
+        const f32 inf = std::numeric_limits<f32>::infinity();
+        Vec<f32> deficit(post_order.size(), inf);
+        for (const TokenSet& ts : lattice_.back()) {
+            for (const Token* t = ts.head; t != nullptr; t = t->next) {
+                deficit[post_index.at(t)] = 0.0;
+            }
+        }
+        auto relax = [&](const Token* p, f32 d) {
+            if (p != nullptr) {
+                f32& x = deficit[post_index.at(p)];
+                x = std::min(x, d);
+            }
+        };
+
+        tokens->clear();
+        deficits->clear();
+        for (int k = post_order.size() - 1; k >= 0; k--) {
+            const Token* t = post_order[k];
+            f32 d = deficit[k];
+            if (d == inf) {
+                continue;  // only reachable via pruned alternatives
+            }
+            post_index[t] = tokens->size();  // predecessors are yet to be visited, so still in post order index
+            tokens->push_back(t);
+            deficits->push_back(d);
+
+            relax(predecessor(t, nullptr), d);
+            for (const LatticeArc* a = alternatives_of(t); a != nullptr; a = a->next) {
+                f32 arc_deficit = d + t->total_score - a->total_score;
+                if (arc_deficit <= config_.lattice_beam) {
+                    relax(predecessor(t, a), arc_deficit);
+                }
+            }
+        }
+    }
+
+
+    // what a snapshot depends on, so that a mismatched search is rejected rather than corrupted
+    void WriteSnapshotLayout(SnapshotWriter* w) const {
+        w->Put<i32>(MaxLms);
+        w->Put<i32>(lms_.size());
+        w->Put<i32>(graphs_.size());
+        for (const Fsm* g : graphs_) {
+            w->Put<i64>(g->num_states);
+            w->Put<i64>(g->num_arcs);
+        }
+    }
+
+
+    Error ReadSnapshotLayout(SnapshotReader* r) const {
+        Str expected, actual;
+        SnapshotWriter w(&expected);
+        WriteSnapshotLayout(&w);
+
+        actual.resize(expected.size());
+        SIO_SNAPSHOT_GET(r->GetBytes(&actual[0], actual.size()));
+        if (actual != expected) {
+            SIO_ERROR << "Snapshot is written by a search with different LMs or graphs.";
+            return Error::InvalidSnapshot;
+        }
+        return Error::OK;
+    }
+
     inline Token* NewToken(const Token* copy_from = nullptr) {
         Token* p = token_allocator_.Alloc();
+        stats_.num_tokens_created++;
         if (copy_from == nullptr) {
             new (p) Token(); // placement new via default constructor
         } else {
@@ -246,8 +1108,76 @@ private:
     }
 
 
+    inline FsmLabel OutputLabel(const Token& t) const {
+        return OutputLabel(t.trace_back);
+    }
+
+
+    inline FsmLabel OutputLabel(const TraceBack<MaxLms>& tb) const {
+        // initial token carries a virtual arc that outputs sentence begin symbol
+        return tb.arc == kFsmNoArc ? tokenizer_->bos : ArcOutputLabel(tb.graph, graphs_[tb.graph]->arcs[tb.arc]);
+    }
+
+
+    // nonterminal arcs entering a subgraph & kFsmInputEnd arcs leaving a subgraph output nothing
+    inline FsmLabel ArcOutputLabel(int graph, const FsmArc& arc) const {
+        if (graph != 0 && arc.ilabel == kFsmInputEnd) {
+            return kFsmEpsilon;
+        }
+        if (arc.ilabel == kFsmEpsilon && !subgraphs_.empty() && subgraphs_.contains(arc.olabel)) {
+            return kFsmEpsilon;
+        }
+        return arc.olabel;
+    }
+
+
+    // whether a search state has arcs to follow without consuming a frame,
+    // i.e. epsilon arcs, or kFsmInputEnd arcs returning from a subgraph instance.
+    inline bool HasEpsilonArcs(StateHandle h) const {
+        int i = HandleToGraph(h);
+        const Fsm& graph = *graphs_[instances_[i].graph];
+        FsmStateId s = HandleToState(h);
+
+        FsmArcId a = graph.states[s].arcs_offset;
+        if (a == graph.states[s + 1].arcs_offset) {
+            return false;
+        }
+        // arcs are sorted by ilabel: kFsmEpsilon < kFsmInputEnd < others
+        FsmLabel ilabel = graph.arcs[a].ilabel;
+        return ilabel == kFsmEpsilon || (i != 0 && ilabel == kFsmInputEnd);
+    }
+
+
+    inline int FindOrAddInstance(int graph, int parent, FsmStateId return_state) {
+        auto res = instance_map_.try_emplace(std::make_tuple(graph, parent, return_state), instances_.size());
+        if (res.second) {
+            instances_.emplace_back(graph, parent, return_state);
+        }
+        return res.first->second;
+    }
+
+
+    // emitting self-loop of each state, only needed by blank frame skipping
+    void BuildSelfLoops(const Fsm& graph, Vec<FsmArcId>* self_loops) {
+        self_loops->clear();
+        if (config_.blank_skip_threshold <= 0.0) {
+            return;
+        }
+
+        self_loops->resize(graph.num_states, kFsmNoArc);
+        for (FsmStateId s = 0; s != graph.num_states; s++) {
+            for (auto aiter = graph.GetArcIterator(s); !aiter.Done(); aiter.Next()) {
+                const FsmArc& arc = aiter.Value();
+                if (arc.dst == s && arc.ilabel != kFsmEpsilon && arc.ilabel != kFsmInputEnd) {
+                    (*self_loops)[s] = graph.ArcId(arc);
+                    break;
+                }
+            }
+        }
+    }
+
+
     inline void DeleteToken(Token *p) {
-        //p->~Token();
         token_allocator_.Free(p);
     }
 
@@ -266,21 +1196,17 @@ private:
     inline int FindOrAddTokenSet(int t, StateHandle h) {
         SIO_CHECK_EQ(cur_time_, t);
 
-        int k;
-        auto it = frontier_map_.find(h);
-        if (it == frontier_map_.end()) {
+        // single hash probe for both lookup & insertion
+        auto res = frontier_map_.try_emplace(h, frontier_.size());
+        if (res.second) {
             TokenSet ts;
             ts.time = t;
             ts.handle = h;
 
-            k = frontier_.size();
             frontier_.push_back(ts);
-            frontier_map_.insert({h, k});
-        } else {
-            k = it->second;
         }
 
-        return k;
+        return res.first->second;
     }
 
 
@@ -294,7 +1220,37 @@ private:
     }
 
 
-    bool TokenPassing(const TokenSet& src, const FsmArc& arc, f32 score, TokenSet* dst) {
+    // Token passed from t along arc, into *nt, reads search states only, see FrontierExpandEmittingParallel()
+    inline void PassToken(const Token& t, int graph, const FsmArc& arc, FsmLabel olabel, f32 score, Token* nt) const {
+        // 1. graph & AM score
+        nt->total_score = t.total_score + arc.score + score;
+
+        // 2. LM
+        if (olabel == kFsmEpsilon) {
+            memcpy(nt->lm_states, t.lm_states, sizeof(LmStateId) * lms_.size());
+        } else {  /* word-end arc */
+            for (int i = 0; i != lms_.size(); i++) {
+                LanguageModel* lm = lms_[i].get();
+
+                LmScore& lm_score = nt->trace_back.lm_scores[i];
+                lm_score = lm->GetScore(t.lm_states[i], olabel, &nt->lm_states[i]);
+                nt->total_score += lm_score;
+            }
+            nt->total_score -= config_.insertion_penalty;
+        }
+
+        // 3. trace back 
+        // this can be moved to back for optimization, keep it here for simplicity
+        nt->trace_back.token = const_cast<Token*>(&t);
+        nt->trace_back.arc = graphs_[graph]->ArcId(arc);
+        nt->trace_back.graph = graph;
+        nt->trace_back.score = score;
+    }
+
+
+    // graph: index of graphs_ that arc belongs to
+    // olabel: output label of arc, see ArcOutputLabel()
+    bool TokenPassing(const TokenSet& src, int graph, const FsmArc& arc, FsmLabel olabel, f32 score, TokenSet* dst) {
         bool changed = false; // dst token set is changed
 
         for (const Token* t = src.head; t != nullptr; t = t->next) {
@@ -302,30 +1258,11 @@ private:
             // here we use a "new token" on stack for probing, 
             // and a heap-based copy is created only after its actual survival.
             Token nt;
-
-            // 1. graph & AM score
-            nt.total_score = t->total_score + arc.score + score;
-
-            // 2. LM
-            if (arc.olabel == kFsmEpsilon) {
-                memcpy(nt.lm_states, t->lm_states, sizeof(LmStateId) * lms_.size());
-            } else {  /* word-end arc */
-                for (int i = 0; i != lms_.size(); i++) {
-                    LanguageModel* lm = lms_[i].get();
-
-                    LmScore& lm_score = nt.trace_back.lm_scores[i];
-                    lm_score = lm->GetScore(t->lm_states[i], arc.olabel, &nt.lm_states[i]);
-                    nt.total_score += lm_score;
-                }
-                nt.total_score -= config_.insertion_penalty;
+            PassToken(*t, graph, arc, olabel, score, &nt);
+            if (olabel != kFsmEpsilon) {
+                stats_.num_lm_calls += lms_.size();
             }
 
-            // 3. trace back 
-            // this can be moved to back for optimization, keep it here for simplicity
-            nt.trace_back.token = const_cast<Token*>(t);
-            nt.trace_back.arc = arc;
-            nt.trace_back.score = score;
-
             // beam pruning
             if (nt.total_score < score_cutoff_) {
                 continue;
@@ -334,60 +1271,140 @@ private:
                 score_max_ = nt.total_score;
             }
 
-            // context recombination
-            bool survived = true;
-            {
-                int k;
-                Token** p;
-                for (k = 0, p = &dst->head; k < config_.token_set_size && *p != nullptr; k++, p = &(*p)->next) {
-                    if (ContextEqual(**p, nt)) {
-                        if ((*p)->total_score < nt.total_score) {  // existing token is worse, remove it
-                            Token *next = (*p)->next;
-                            DeleteToken(*p);
-                            *p = next;
-
-                            changed = true;
-                        } else {  // existing token is better, kill new token
-                            survived = false;
-                        }
+            changed |= RecombineToken(nt, dst);
+        } // for each token in src token set
 
-                        break;
-                    }
+        if (changed) {
+            dst->best_score = dst->head->total_score;
+        }
+
+        return changed;
+    }
+
+
+    // Context recombination & token_set_size truncation of a token surviving beam pruning at dst
+    bool RecombineToken(const Token& nt, TokenSet* dst) {
+        bool changed = false; // dst token set is changed
+
+        // context recombination
+        bool survived = true;
+        Nullable<Token*> replaced = nullptr;
+        {
+            int k;
+            Token** p;
+            for (k = 0, p = &dst->head; k < config_.token_set_size && *p != nullptr; k++, p = &(*p)->next) {
+                if (ContextEqual(**p, nt)) {
+                    if ((*p)->total_score < nt.total_score) {  // existing token is worse, remove it
+                        // removed token may already be traced back by epsilon successors,
+                        // so detach it instead of deletion, GC will reclaim it when unreachable.
+                        replaced = *p;
+                        Token *next = (*p)->next;
+                        DetachToken(*p);
+                        *p = next;
+
+                        changed = true;
+                    } else {  // existing token is better, kill new token
+                        survived = false;
+                        if (config_.lattice_beam > 0.0) {
+                            AddAlternative(*p, nt.total_score, nt.trace_back);
+                        }
+                    }
+                    stats_.num_tokens_recombined++;
+
+                    break;
                 }
             }
+        }
 
-            if (survived) {
-                int k;
-                Token** p;
-                for (k = 0, p = &dst->head; k < config_.token_set_size && *p != nullptr; k++, p = &(*p)->next) {
-                    if ((*p)->total_score <= nt.total_score) {
-                        break;
-                    }
+        if (survived) {
+            int k;
+            Token** p;
+            for (k = 0, p = &dst->head; k < config_.token_set_size && *p != nullptr; k++, p = &(*p)->next) {
+                if ((*p)->total_score <= nt.total_score) {
+                    break;
                 }
+            }
 
-                if (k != config_.token_set_size) {
-                    Token* q = NewToken(&nt); // actual heap copy to insert
+            if (k != config_.token_set_size) {
+                Token* q = NewToken(&nt); // actual heap copy to insert
 
-                    q->next = *p;
-                    *p = q;
+                q->next = *p;
+                *p = q;
+                if (replaced != nullptr && config_.lattice_beam > 0.0) {
+                    MoveAlternatives(replaced, q);
+                }
 
-                    changed = true;
+                // keep at most token_set_size tokens
+                for (; k < config_.token_set_size && *p != nullptr; k++, p = &(*p)->next) { }
+                while (*p != nullptr) {
+                    Token* next = (*p)->next;
+                    if (config_.lattice_beam > 0.0) {
+                        MoveAlternatives(*p, dst->head);
+                    }
+                    DetachToken(*p);
+                    *p = next;
                 }
+
+                changed = true;
+            } else if (config_.lattice_beam > 0.0) {  // truncated by token_set_size
+                AddAlternative(dst->head, nt.total_score, nt.trace_back);
             }
+        }
 
-        } // for each token in src token set
+        return changed;
+    }
 
-        if (changed) {
-            dst->best_score = dst->head->total_score;
+
+    // Word lattice mode: a hypothesis dropped at a TokenSet becomes an alternative arc of the token beating it.
+    // Alternatives dropped by token_set_size truncation have other LM contexts than that token,
+    // so scores of their continuations are approximated by that token's.
+    inline void AddAlternative(const Token* to, f32 total_score, const TraceBack<MaxLms>& trace_back) {
+        if (to->total_score - total_score > config_.lattice_beam) {
+            return;
         }
+        LatticeArc* a = lattice_arc_allocator_.Alloc();
+        new (a) LatticeArc();
+        a->total_score = total_score;
+        a->trace_back = trace_back;
+
+        LatticeArc*& head = alternatives_[to];
+        a->next = head;
+        head = a;
+        stats_.num_lattice_arcs++;
+    }
 
-        return changed;
+
+    // A token dropped from its TokenSet: its own best arc & alternatives are moved to the token beating it.
+    // Epsilon successors of the dropped token still trace back to it via its best arc only.
+    inline void MoveAlternatives(const Token* from, const Token* to) {
+        AddAlternative(to, from->total_score, from->trace_back);
+
+        auto it = alternatives_.find(from);
+        if (it == alternatives_.end()) {
+            return;
+        }
+        LatticeArc* a = it->second;
+        alternatives_.erase(it);
+
+        LatticeArc*& head = alternatives_[to];
+        while (a != nullptr) {
+            LatticeArc* next = a->next;
+            if (to->total_score - a->total_score > config_.lattice_beam) {
+                lattice_arc_allocator_.Free(a);
+            } else {
+                a->next = head;
+                head = a;
+            }
+            a = next;
+        }
     }
 
 
     Error InitSession() {
+        stats_.Reset();
+        stats_.num_sessions = 1;
+
         SIO_CHECK_EQ(token_allocator_.NumUsed(), 0);
-        token_allocator_.SetSlabSize(config_.token_allocator_slab_size);
 
         SIO_CHECK(lattice_.empty());
         lattice_.reserve(25 * 30); // 25 frame_rates(subsample = 4) * 30 seconds
@@ -403,12 +1420,13 @@ private:
             score_offsets_.push_back(0.0);
         }
 
+        SIO_CHECK(instances_.empty());
+        instances_.emplace_back(0, -1, 0); // main graph instance
+
         // Initialize search session
         status_ = SearchStatus::kBusy;
 
-        Token* t = NewToken();
-        t->trace_back.arc.ilabel = kFsmEpsilon;
-        t->trace_back.arc.olabel = tokenizer_->bos;
+        Token* t = NewToken(); // trace_back.arc = kFsmNoArc, i.e. outputs bos
 
         for (int i = 0; i != lms_.size(); i++) {
             LanguageModel* lm = lms_[i].get();
@@ -416,6 +1434,7 @@ private:
             LmScore bos_score = lm->GetScore(lm->NullState(), tokenizer_->bos, &t->lm_states[i]);
             t->total_score += bos_score;
         }
+        stats_.num_lm_calls += lms_.size();
 
         SIO_CHECK_EQ(cur_time_, 0);
         int k = FindOrAddTokenSet(cur_time_, ComposeStateHandle(0, graph_->start_state));
@@ -426,8 +1445,9 @@ private:
         ts.head = t;
         ts.best_score = t->total_score;
 
+        beam_ = config_.beam;
         score_max_ = ts.best_score;
-        score_cutoff_ = score_max_ - config_.beam;
+        score_cutoff_ = score_max_ - beam_;
 
         FrontierExpandEpsilon();
         FrontierPinDown();
@@ -441,8 +1461,17 @@ private:
         frontier_.clear();
         frontier_map_.clear();
 
+        instances_.clear();
+        instance_map_.clear();
+
         lattice_.clear();
-        token_allocator_.Reset();
+        token_set_arena_.Reset();
+        detached_tokens_ = nullptr;
+        gc_marks_.clear();
+        alternatives_.clear();
+        // slabs are kept for next session, up to a high-water cap
+        token_allocator_.ResetRetainCapacity(std::max(config_.token_allocator_max_retained_slabs, 0));
+        lattice_arc_allocator_.ResetRetainCapacity(std::max(config_.token_allocator_max_retained_slabs, 0));
 
         if (config_.apply_score_offsets) {
             score_offsets_.clear();
@@ -450,16 +1479,125 @@ private:
 
         nbest_.clear();
 
+        stable_token_ = nullptr;
+        stable_prefix_.clear();
+        partial_.clear();
+        best_chain_.clear();
+        meet_index_.clear();
+
         status_ = SearchStatus::kIdle;
 
         return Error::OK;
     }
 
 
+    // Push() is split around emitting expansion, so BatchBeamSearch can share it among sessions
+    void BeginFrame() {
+        SIO_CHECK(status_ == SearchStatus::kIdle || status_ == SearchStatus::kBusy);
+        if (status_ == SearchStatus::kIdle) {
+            InitSession();
+            OnSessionBegin();
+        }
+        SIO_CHECK(status_ == SearchStatus::kBusy);
+
+        OnFrameBegin();
+    }
+
+
+    //   emitting_ms: time of emitting expansion, reported as part of expand_ms
+    void EndFrame(f32 emitting_ms) {
+        auto expand_begin = std::chrono::steady_clock::now();
+        FrontierExpandEpsilon();
+        stats_.expand_ms.Add(emitting_ms + ElapsedMs(expand_begin));
+
+        auto prune_begin = std::chrono::steady_clock::now();
+        FrontierPrune();
+        FrontierPinDown();
+        stats_.prune_ms.Add(ElapsedMs(prune_begin));
+
+        OnFrameEnd();
+    }
+
+
     Error FrontierExpandEmitting(const float* frame_score) {
+        f32 score_offset = BeginEmitting();
+
+        // blank frame: hypotheses are very unlikely to move to other states, so only self-loops are expanded,
+        // e.g. blank self-loop & token self-loops in CTC topology
+        if (BlankSkipped(frame_score)) {
+            for (const TokenSet& src : lattice_.back()) {
+                int i = HandleToGraph(src.handle);
+                int g = instances_[i].graph;
+                FsmArcId a = self_loops_[g][HandleToState(src.handle)];
+                if (a != kFsmNoArc) {
+                    ExpandEmittingArc(src, i, g, graphs_[g]->arcs[a], frame_score, score_offset);
+                }
+            }
+            stats_.num_blank_skipped_frames++;
+            return Error::OK;
+        }
+
+        if (SelectsLabels()) {
+            SelectLabels(frame_score);
+            for (const TokenSet& src : lattice_.back()) {
+                int i = HandleToGraph(src.handle);
+                int g = instances_[i].graph;
+                const Fsm& graph = *graphs_[g];
+
+                FsmStateId s = HandleToState(src.handle);
+                const FsmArc* begin = graph.arcs.data() + graph.states[s].arcs_offset;
+                const FsmArc* end = graph.arcs.data() + graph.states[s + 1].arcs_offset;
+
+                if (static_cast<size_t>(end - begin) > 4 * labels_.size()) {
+                    // large fan-out state, e.g. start state of CTC topology:
+                    // arcs are sorted by ilabel, so locate arcs of each selected label via binary search
+                    const FsmArc* arc = begin;
+                    for (FsmLabel label : labels_) {
+                        arc = std::lower_bound(arc, end, label,
+                            [](const FsmArc& x, FsmLabel l) { return x.ilabel < l; }
+                        );
+                        for (; arc != end && arc->ilabel == label; ++arc) {
+                            ExpandEmittingArc(src, i, g, *arc, frame_score, score_offset);
+                        }
+                    }
+                } else {
+                    for (const FsmArc* arc = begin; arc != end; ++arc) {
+                        if (arc->ilabel >= 0 && label_selected_[arc->ilabel]) {
+                            ExpandEmittingArc(src, i, g, *arc, frame_score, score_offset);
+                        }
+                    }
+                }
+            }
+
+            for (FsmLabel label : labels_) {
+                label_selected_[label] = false;
+            }
+            return Error::OK;
+        }
+
+        if (expansion_pool_ && SplittableExpansion() && lattice_.back().size() > config_.expansion_shard_size) {
+            return FrontierExpandEmittingParallel(frame_score, score_offset);
+        }
+
+        for (const TokenSet& src : lattice_.back()) {
+            int i = HandleToGraph(src.handle);
+            int g = instances_[i].graph;
+            for (auto aiter = graphs_[g]->GetArcIterator(HandleToState(src.handle)); !aiter.Done(); aiter.Next()) {
+                const FsmArc& arc = aiter.Value();
+                if (arc.ilabel != kFsmEpsilon && arc.ilabel != kFsmInputEnd) {
+                    ExpandEmittingArc(src, i, g, arc, frame_score, score_offset);
+                }
+            }
+        }
+        return Error::OK;
+    }
+
+
+    // Consumes a time frame, returns score offset of its frame
+    f32 BeginEmitting() {
         SIO_CHECK(frontier_.empty());
 
-        cur_time_++; // consumes a time frame
+        cur_time_++;
         score_max_ -= 1000.0;
         score_cutoff_ -= 1000.0;
 
@@ -467,23 +1605,227 @@ private:
         if (config_.apply_score_offsets) {
             score_offset = score_offsets_.back();
         }
+        return score_offset;
+    }
 
-        for (const TokenSet& src : lattice_.back()) {
-            for (auto aiter = graph_->GetArcIterator(HandleToState(src.handle)); !aiter.Done(); aiter.Next()) {
+
+    bool BlankSkipped(const float* frame_score) const {
+        return config_.blank_skip_threshold > 0.0 && frame_score[tokenizer_->blk] > blank_skip_score_;
+    }
+
+
+    bool SelectsLabels() const {
+        return config_.label_topk > 0 || config_.label_beam > 0.0;
+    }
+
+
+    // Whether serial emitting expansion over all emitting arcs can be split by source TokenSets,
+    // see FrontierExpandEmittingParallel()
+    bool SplittableExpansion() const {
+        bool stateless_lms = std::all_of(lms_.begin(), lms_.end(), [](const Unique<LanguageModel*>& lm) {
+            return lm->IsStateless();
+        });
+        return stateless_lms && config_.insertion_penalty >= 0.0;
+    }
+
+
+    // Serial expansion with its beam moving as tokens arrive, split into 3 passes over shards of source TokenSets:
+    //   1. workers: token scores lifting the beam within each shard, scored from the shard's own beginning.
+    //   2. this thread: replays these records shard by shard, which yields the beam at each shard begin,
+    //      since a token lifts the serial beam iff it exceeds both the beam at shard begin & earlier shard records.
+    //      workers: pass arcs & tokens of each shard from that beam, exactly as serial expansion would.
+    //   3. this thread: surviving tokens are recombined & allocated in serial order.
+    // LMs are called by workers, so this is only for stateless LMs, whose scores can't lift a token above
+    // best score of its source TokenSet + arc score, so arcs skipped by serial beam hold no records.
+    Error FrontierExpandEmittingParallel(const float* frame_score, f32 score_offset) {
+        const int num_srcs = lattice_.back().size();
+        const int shard_size = config_.expansion_shard_size;
+        const int num_shards = (num_srcs + shard_size - 1) / shard_size;
+        if (shards_.size() < num_shards) {
+            shards_.resize(num_shards);
+        }
+
+        auto run_shards = [&](bool pass_tokens) {
+            Vec<std::future<void>> done;
+            for (int k = 0; k != num_shards; k++) {
+                done.push_back(expansion_pool_->Submit([=]() {
+                    ExpandShard(frame_score, score_offset, k * shard_size, std::min(num_srcs, (k + 1) * shard_size),
+                        pass_tokens, &shards_[k]
+                    );
+                }));
+            }
+            for (std::future<void>& f : done) {
+                f.get();
+            }
+        };
+
+        run_shards(false);
+        for (int k = 0; k != num_shards; k++) {
+            ReplayShard(&shards_[k]);
+        }
+        run_shards(true);
+        stats_.num_parallel_frames++;
+
+        for (int k = 0; k != num_shards; k++) {
+            RecombineShard(shards_[k]);
+        }
+        return Error::OK;
+    }
+
+
+    // Runs on worker threads, reads search states only, see FrontierExpandEmittingParallel()
+    void ExpandShard(const float* frame_score, f32 score_offset, int begin, int end, bool pass_tokens,
+        ExpansionShard* shard
+    ) const {
+        BeginShard(pass_tokens, shard);
+        for (int k = begin; k != end; k++) {
+            const TokenSet& src = lattice_.back()[k];
+            int g = instances_[HandleToGraph(src.handle)].graph;
+            for (auto aiter = graphs_[g]->GetArcIterator(HandleToState(src.handle)); !aiter.Done(); aiter.Next()) {
                 const FsmArc& arc = aiter.Value();
                 if (arc.ilabel != kFsmEpsilon && arc.ilabel != kFsmInputEnd) {
-                    f32 score = frame_score[arc.ilabel] + score_offset;
-                    if (src.best_score + arc.score + score < score_cutoff_) continue;
+                    ExpandShardArc(frame_score, score_offset, k, g, arc, pass_tokens, shard);
+                }
+            }
+        }
+    }
 
-                    TokenSet& dst = frontier_[
-                        FindOrAddTokenSet(cur_time_, ComposeStateHandle(0, arc.dst))
-                    ];
 
-                    TokenPassing(src, arc, score, &dst);
+    void BeginShard(bool pass_tokens, ExpansionShard* shard) const {
+        if (pass_tokens) {  // beam is set by ReplayShard()
+            shard->arcs.clear();
+            shard->tokens.clear();
+            shard->num_arcs_visited = 0;
+            shard->num_lm_calls = 0;
+        } else {
+            shard->records.clear();
+            shard->score_max = -std::numeric_limits<f32>::infinity();
+        }
+    }
+
+
+    // Expands emitting arc of lattice_.back()[k] within a shard, see FrontierExpandEmittingParallel()
+    //   g: index of graphs_ that arc belongs to
+    inline void ExpandShardArc(const float* frame_score, f32 score_offset, int k, int g, const FsmArc& arc,
+        bool pass_tokens, ExpansionShard* shard
+    ) const {
+        const TokenSet& src = lattice_.back()[k];
+        f32 score = frame_score[arc.ilabel] + score_offset;  // same arithmetic as ExpandEmittingArc()
+
+        if (!pass_tokens) {
+            if (src.best_score + arc.score + score <= shard->score_max) return;  // holds no records
+            for (const Token* t = src.head; t != nullptr; t = t->next) {
+                Token nt;
+                PassToken(*t, g, arc, arc.olabel, score, &nt);
+                if (nt.total_score > shard->score_max) {
+                    shard->records.push_back(nt.total_score);
+                    shard->score_max = nt.total_score;
                 }
             }
+            return;
+        }
+
+        shard->num_arcs_visited++;
+        if (src.best_score + arc.score + score < shard->score_cutoff) return;
+        for (const Token* t = src.head; t != nullptr; t = t->next) {
+            Token nt;
+            PassToken(*t, g, arc, arc.olabel, score, &nt);
+            if (arc.olabel != kFsmEpsilon) {
+                shard->num_lm_calls += lms_.size();
+            }
+            if (nt.total_score < shard->score_cutoff) {  // same beam updates as TokenPassing()
+                continue;
+            } else if (nt.total_score > shard->score_max) {
+                shard->score_cutoff += (nt.total_score - shard->score_max);
+                shard->score_max = nt.total_score;
+            }
+            shard->tokens.push_back(nt);
+        }
+        shard->arcs.push_back({k, &arc, static_cast<int>(shard->tokens.size())});
+    }
+
+
+    // Pass 2 of shards in serial order: beam at shard begin, then lifted by the shard's records
+    void ReplayShard(ExpansionShard* shard) {
+        shard->score_max = score_max_;
+        shard->score_cutoff = score_cutoff_;
+        for (f32 x : shard->records) {
+            if (x > score_max_) {  // same arithmetic as TokenPassing()
+                score_cutoff_ += (x - score_max_);
+                score_max_ = x;
+            }
         }
-        return Error::OK;
+    }
+
+
+    // Pass 3 of shards in serial order
+    void RecombineShard(const ExpansionShard& shard) {
+        stats_.num_arcs_visited += shard.num_arcs_visited;
+        stats_.num_lm_calls += shard.num_lm_calls;
+
+        int j = 0;
+        for (const auto& x : shard.arcs) {  // arcs without surviving tokens still add TokenSets, as in serial
+            int i = HandleToGraph(lattice_.back()[x.src].handle);
+            TokenSet& dst = frontier_[
+                FindOrAddTokenSet(cur_time_, ComposeStateHandle(i, x.arc->dst))
+            ];
+            bool changed = false;
+            for (; j != x.tokens_end; j++) {
+                changed |= RecombineToken(shard.tokens[j], &dst);
+            }
+            if (changed) {
+                dst.best_score = dst.head->total_score;
+            }
+        }
+    }
+
+
+    // Selects labels of current frame via label_topk & label_beam, into labels_ & label_selected_
+    void SelectLabels(const float* frame_score) {
+        int vocab = tokenizer_->Size();
+        label_selected_.resize(vocab, false);
+
+        labels_.resize(vocab);
+        for (FsmLabel l = 0; l != vocab; l++) {
+            labels_[l] = l;
+        }
+        auto better = [frame_score](FsmLabel x, FsmLabel y) {
+            return (frame_score[x] != frame_score[y]) ? (frame_score[x] > frame_score[y]) : (x < y);
+        };
+
+        if (config_.label_topk > 0 && config_.label_topk < vocab) {
+            std::nth_element(labels_.begin(), labels_.begin() + config_.label_topk - 1, labels_.end(), better);
+            labels_.resize(config_.label_topk);
+        }
+
+        if (config_.label_beam > 0.0) {
+            f32 cutoff = frame_score[*std::min_element(labels_.begin(), labels_.end(), better)] - config_.label_beam;
+            labels_.erase(
+                std::remove_if(labels_.begin(), labels_.end(), [=](FsmLabel l) { return frame_score[l] < cutoff; }),
+                labels_.end()
+            );
+        }
+
+        std::sort(labels_.begin(), labels_.end());
+        for (FsmLabel l : labels_) {
+            label_selected_[l] = true;
+        }
+    }
+
+
+    // instance: graph instance of src, graph: graph of that instance
+    inline void ExpandEmittingArc(
+        const TokenSet& src, int instance, int graph, const FsmArc& arc, const float* frame_score, f32 score_offset
+    ) {
+        stats_.num_arcs_visited++;
+        f32 score = frame_score[arc.ilabel] + score_offset;
+        if (src.best_score + arc.score + score < score_cutoff_) return;
+
+        TokenSet& dst = frontier_[
+            FindOrAddTokenSet(cur_time_, ComposeStateHandle(instance, arc.dst))
+        ];
+
+        TokenPassing(src, graph, arc, arc.olabel, score, &dst);
     }
 
 
@@ -491,30 +1833,47 @@ private:
         SIO_CHECK(eps_queue_.empty());
 
         for (int k = 0; k != frontier_.size(); k++) {
-            if (graph_->ContainEpsilonArc(HandleToState(frontier_[k].handle))) {
+            if (HasEpsilonArcs(frontier_[k].handle)) {
                 eps_queue_.push_back(k);
             }
         }
 
         while (!eps_queue_.empty()) {
             int src_k = eps_queue_.back(); eps_queue_.pop_back();
-            const TokenSet& src = frontier_[src_k];
+            const TokenSet src = frontier_[src_k]; // copy, frontier_ may reallocate during expansion
 
             if (src.best_score < score_cutoff_) continue;
 
-            for (auto aiter = graph_->GetArcIterator(HandleToState(src.handle)); !aiter.Done(); aiter.Next()) {
+            int i = HandleToGraph(src.handle);
+            int g = instances_[i].graph;
+            for (auto aiter = graphs_[g]->GetArcIterator(HandleToState(src.handle)); !aiter.Done(); aiter.Next()) {
                 const FsmArc& arc = aiter.Value();
+
+                StateHandle h;
                 if (arc.ilabel == kFsmEpsilon) {
-                    if (src.best_score + arc.score < score_cutoff_) continue;
+                    auto it = subgraphs_.empty() ? subgraphs_.end() : subgraphs_.find(arc.olabel);
+                    if (it == subgraphs_.end()) {
+                        h = ComposeStateHandle(i, arc.dst);
+                    } else {  // nonterminal arc: enters subgraph
+                        int sub = it->second;
+                        h = ComposeStateHandle(FindOrAddInstance(sub, i, arc.dst), graphs_[sub]->start_state);
+                    }
+                } else if (arc.ilabel == kFsmInputEnd && i != 0) {  // returns from subgraph
+                    h = ComposeStateHandle(instances_[i].parent, instances_[i].return_state);
+                } else {
+                    continue;
+                }
 
-                    int dst_k = FindOrAddTokenSet(cur_time_, ComposeStateHandle(0, arc.dst));
-                    TokenSet& dst = frontier_[dst_k];
+                stats_.num_arcs_visited++;
+                if (src.best_score + arc.score < score_cutoff_) continue;
 
-                    bool changed = TokenPassing(src, arc, 0.0, &dst);
+                int dst_k = FindOrAddTokenSet(cur_time_, h);
+                TokenSet& dst = frontier_[dst_k];
 
-                    if (changed && graph_->ContainEpsilonArc(arc.dst)) {
-                        eps_queue_.push_back(dst_k);
-                    }
+                bool changed = TokenPassing(src, g, arc, ArcOutputLabel(g, arc), 0.0, &dst);
+
+                if (changed && HasEpsilonArcs(h)) {
+                    eps_queue_.push_back(dst_k);
                 }
             }
         }
@@ -527,13 +1886,17 @@ private:
         SIO_CHECK(frontier_.empty());
 
         for (const TokenSet& src : lattice_.back()) {
+            if (HandleToGraph(src.handle) != 0) {
+                continue; // kFsmInputEnd arcs of subgraph instances are returns, already expanded as epsilons
+            }
             for (auto aiter = graph_->GetArcIterator(HandleToState(src.handle)); !aiter.Done(); aiter.Next()) {
                 const FsmArc& arc = aiter.Value();
                 if (arc.ilabel == kFsmInputEnd) {
+                    stats_.num_arcs_visited++;
                     TokenSet& dst = frontier_[
                         FindOrAddTokenSet(cur_time_, ComposeStateHandle(0, arc.dst))
                     ];
-                    TokenPassing(src, arc, 0.0, &dst);
+                    TokenPassing(src, 0, arc, arc.olabel, 0.0, &dst);
                 }
             }
         }
@@ -544,23 +1907,44 @@ private:
 
 
     Error FrontierPrune() {
-        score_cutoff_ = score_max_ - config_.beam;
+        if (config_.adaptive_target_active > 0) {
+            f32 worst = score_max_;
+            for (const TokenSet& ts : frontier_) {
+                worst = std::min(worst, ts.best_score);
+            }
+            frame_num_candidates_ = frontier_.size();
+            frame_score_spread_ = score_max_ - worst;
+        }
+
+        score_cutoff_ = score_max_ - beam_;
 
         // adapt beam regarding to max_active constraint
         if (config_.max_active > 0 && frontier_.size() > config_.max_active) {
-            std::nth_element(
-                frontier_.begin(),
-                frontier_.begin() + config_.max_active - 1,
-                frontier_.end(),
-                TokenSetBetterThan
-            );
+            f32 worst_survivor_score;
+            if (config_.histogram_bins > 0) {
+                histogram_.resize(config_.histogram_bins);
+                worst_survivor_score = HistogramPrune(
+                    &frontier_, config_.max_active, score_max_, beam_, &histogram_
+                ).best_score;
+            } else {
+                worst_survivor_score = NthElementPrune(&frontier_, config_.max_active).best_score;
+            }
+
+            // tokens of pruned TokenSets may still be traced back by survivors via epsilon arcs,
+            // so they are detached for GC rather than deleted here.
+            for (int k = config_.max_active; k != frontier_.size(); k++) {
+                DetachTokenSet(&frontier_[k]);
+            }
             frontier_.resize(config_.max_active);
 
-            score_cutoff_ = std::max(score_cutoff_, frontier_.back().best_score);
+            score_cutoff_ = std::max(score_cutoff_, worst_survivor_score);
         }
 
         // put best TokenSet first so that beam of next frame will be established quickly.
-        std::nth_element(frontier_.begin(), frontier_.begin(), frontier_.end(), TokenSetBetterThan);
+        std::iter_swap(
+            frontier_.begin(),
+            std::min_element(frontier_.begin(), frontier_.end(), TokenSetBetterThan<MaxLms>)
+        );
         SIO_CHECK_EQ(frontier_[0].best_score, score_max_);
         
         return Error::OK;
@@ -568,10 +1952,13 @@ private:
 
 
     Error FrontierPinDown() {
-        // use "copy" instead of "move" in push_back(),
-        // so frontier's capacity() is reserved after clear(),
-        // to avoid unnecessary reallocations across frames.
-        lattice_.push_back(frontier_);
+        // GC before pinning: latest frame is still in frontier_, so all pinned frames can be dropped
+        if (config_.token_gc_interval > 0 && cur_time_ > 0 && cur_time_ % config_.token_gc_interval == 0) {
+            CollectGarbage();
+        }
+
+        // a copy into pre-reserved arena memory, frontier's capacity() is kept across frames as well
+        lattice_.push_back(token_set_arena_.Append(frontier_.data(), frontier_.size()));
 
         frontier_.clear();
         frontier_map_.clear();
@@ -580,11 +1967,102 @@ private:
             score_offsets_.push_back(-score_max_);
         }
 
-        //for (TokenSet& ts : lattice_.back()) {
-        //    for (Token* t = ts.head; t != nullptr; t = t->next) {
-        //        t->master = &ts;
-        //    }
-        //}
+        return Error::OK;
+    }
+
+
+    inline void DetachToken(Token* t) {
+        t->next = detached_tokens_;
+        detached_tokens_ = t;
+    }
+
+
+    inline void DetachTokenSet(TokenSet* ts) {
+        Token* t = ts->head;
+        while (t != nullptr) {
+            Token* next = t->next;
+            DetachToken(t);
+            t = next;
+        }
+        ts->head = nullptr;
+    }
+
+
+    // Mark & sweep, runs before latest frame(frontier_) is pinned:
+    //   1. mark: tokens reachable from latest frame, via trace back chains (& alternative arcs in lattice mode).
+    //   2. sweep: delete unmarked tokens of pinned frames & detached tokens,
+    //      marked ones are kept in detached list for later trace back.
+    // After GC, all pinned frames are dropped from lattice_ & arena.
+    Error CollectGarbage() {
+        SIO_CHECK(!lattice_.empty());
+
+        gc_marks_.clear();
+        gc_stack_.clear();
+        for (const TokenSet& ts : frontier_) {
+            for (const Token* t = ts.head; t != nullptr; t = t->next) {
+                gc_stack_.push_back(t);
+            }
+        }
+        while (!gc_stack_.empty()) {
+            const Token* t = gc_stack_.back();
+            gc_stack_.pop_back();
+            // stop at already marked token, because its predecessors are marked as well.
+            for (const Token* p = t; p != nullptr && gc_marks_.insert(p).second; p = p->trace_back.token) {
+                if (!alternatives_.empty()) {
+                    auto it = alternatives_.find(p);
+                    if (it != alternatives_.end()) {
+                        for (const LatticeArc* a = it->second; a != nullptr; a = a->next) {
+                            gc_stack_.push_back(a->trace_back.token);
+                        }
+                    }
+                }
+            }
+        }
+
+        i64 n = 0;
+        Token* survivors = nullptr;
+        auto sweep = [&](Token* head) {
+            Token* t = head;
+            while (t != nullptr) {
+                Token* next = t->next;
+                if (gc_marks_.contains(t)) {
+                    t->next = survivors;
+                    survivors = t;
+                } else {
+                    DeleteToken(t);
+                    n++;
+                }
+                t = next;
+            }
+        };
+
+        for (const Span<TokenSet>& frame : lattice_) {
+            for (const TokenSet& ts : frame) {
+                sweep(ts.head);
+            }
+        }
+        sweep(detached_tokens_);
+        detached_tokens_ = survivors;
+
+        // alternatives of deleted tokens
+        for (auto it = alternatives_.begin(); it != alternatives_.end(); ) {
+            if (gc_marks_.contains(it->first)) {
+                ++it;
+                continue;
+            }
+            for (LatticeArc* a = it->second; a != nullptr; ) {
+                LatticeArc* next = a->next;
+                lattice_arc_allocator_.Free(a);
+                a = next;
+            }
+            alternatives_.erase(it++);
+        }
+
+        lattice_.clear();
+        token_set_arena_.Reset();
+
+        stats_.num_gc++;
+        stats_.num_gc_reclaimed_tokens += n;
 
         return Error::OK;
     }
@@ -600,13 +2078,18 @@ private:
             return Error::NoRecognitionResult;
         }
 
+        if (config_.lattice_beam > 0.0) {
+            return LatticeNBest(frontier_[it->second]);
+        }
+
         int k;
         Token* p;
         for (k = 0, p = frontier_[it->second].head; k < config_.nbest && p != nullptr; k++, p = p->next) {
             Vec<TokenId> path;
             for(Token* t = p; t != nullptr; t = t->trace_back.token) {
-                if (t->trace_back.arc.olabel != kFsmEpsilon) {
-                    path.push_back(t->trace_back.arc.olabel);
+                FsmLabel olabel = OutputLabel(*t);
+                if (olabel != kFsmEpsilon) {
+                    path.push_back(olabel);
                 }
             }
             std::reverse(path.begin(), path.end());
@@ -618,6 +2101,140 @@ private:
     }
 
 
+    // A* over word lattice, backwards from final tokens to the initial token:
+    //   1. an entry is a partial path from the end back to a token, entering it via its best arc or an alternative.
+    //   2. heuristic of a token is its total_score, i.e. exact best score from session begin,
+    //      so entries are popped in order of complete path scores.
+    //   3. a token is expanded at most once per label suffix, i.e. only via the best entry of that suffix,
+    //      so alignments differing only in frames of labels are not enumerated again & again.
+    //   4. distinct label sequences are taken, until nbest or lattice_nbest_max_pops is reached.
+    Error LatticeNBest(const TokenSet& final) {
+        struct Entry {
+            const TraceBack<MaxLms>* arc;  // arc entering the token of this entry
+            int parent;  // entry of arc's destination token, -1 -> final token
+            u64 suffix;  // hash of output labels from this arc to the end
+        };
+        Vec<Entry> entries;
+        std::priority_queue<std::pair<f32, int>> heap;  // (complete path score, index of entries)
+
+        auto push = [&](const TraceBack<MaxLms>* arc, int parent, f32 score) {
+            u64 suffix = (parent == -1) ? 0 : entries[parent].suffix;
+            FsmLabel olabel = OutputLabel(*arc);
+            if (olabel != kFsmEpsilon) {
+                suffix = (suffix ^ static_cast<u32>(olabel)) * 0x100000001b3ULL + 0x9e3779b97f4a7c15ULL;
+            }
+            entries.push_back({arc, parent, suffix});
+            heap.emplace(score, entries.size() - 1);
+        };
+
+        // score: best complete path score via token t's best arc
+        auto push_arcs_into = [&](const Token* t, int parent, f32 score) {
+            push(&t->trace_back, parent, score);
+
+            auto it = alternatives_.find(t);
+            if (it != alternatives_.end()) {
+                for (const LatticeArc* a = it->second; a != nullptr; a = a->next) {
+                    push(&a->trace_back, parent, score - t->total_score + a->total_score);
+                }
+            }
+        };
+
+        for (const Token* t = final.head; t != nullptr; t = t->next) {
+            push_arcs_into(t, -1, t->total_score);
+        }
+
+        FastSet<std::pair<const Token*, u64>> expanded;
+        FastSet<Vec<TokenId>> seen;
+        for (int n = 0; n != config_.lattice_nbest_max_pops && !heap.empty() && nbest_.size() < config_.nbest; n++) {
+            f32 score = heap.top().first;
+            int e = heap.top().second;
+            heap.pop();
+
+            const Token* src = entries[e].arc->token;
+            if (src != nullptr) {
+                if (expanded.emplace(src, entries[e].suffix).second) {
+                    push_arcs_into(src, e, score);
+                }
+                continue;
+            }
+
+            // reaches initial token, entries from here to final token are in time order
+            Vec<TokenId> path;
+            for (int k = e; k != -1; k = entries[k].parent) {
+                FsmLabel olabel = OutputLabel(*entries[k].arc);
+                if (olabel != kFsmEpsilon) {
+                    path.push_back(olabel);
+                }
+            }
+            if (seen.insert(path).second) {
+                nbest_.push_back(std::move(path));
+            }
+        }
+
+        return Error::OK;
+    }
+
+
+    // Find the latest common ancestor of all tokens in latest frame:
+    //   1. best_chain_: trace back of best token, down to (but excluding) previous stable_token_
+    //   2. each other token traces back until it meets best_chain_,
+    //      so the oldest meeting point is shared by all tokens.
+    // Each token after previous stable_token_ is visited at most once.
+    Error UpdateStablePrefix() {
+        best_chain_.clear();
+        meet_index_.clear();
+
+        const Token* best = nullptr;
+        for (const TokenSet& ts : lattice_.back()) {
+            if (ts.head != nullptr && (best == nullptr || ts.head->total_score > best->total_score)) {
+                best = ts.head;
+            }
+        }
+        SIO_CHECK(best != nullptr);
+
+        for (const Token* t = best; t != stable_token_; t = t->trace_back.token) {
+            SIO_CHECK(t != nullptr);
+            meet_index_[t] = best_chain_.size();
+            best_chain_.push_back(t);
+        }
+
+        int oldest_meet = 0;
+        Vec<const Token*> path;
+        for (const TokenSet& ts : lattice_.back()) {
+            for (const Token* t = ts.head; t != nullptr; t = t->next) {
+                int meet = best_chain_.size(); // meet at previous stable_token_
+                path.clear();
+                for (const Token* p = t; p != stable_token_; p = p->trace_back.token) {
+                    auto it = meet_index_.find(p);
+                    if (it != meet_index_.end()) {
+                        meet = it->second;
+                        break;
+                    }
+                    path.push_back(p);
+                }
+                for (const Token* p : path) {
+                    meet_index_[p] = meet;
+                }
+                oldest_meet = std::max(oldest_meet, meet);
+            }
+        }
+
+        // move newly stable part of best_chain_, i.e. [oldest_meet, end), into stable prefix
+        for (int i = best_chain_.size() - 1; i >= oldest_meet; i--) {
+            FsmLabel olabel = OutputLabel(*best_chain_[i]);
+            if (olabel != kFsmEpsilon) {
+                stable_prefix_.push_back(olabel);
+            }
+        }
+        if (oldest_meet != best_chain_.size()) {
+            stable_token_ = best_chain_[oldest_meet];
+            best_chain_.resize(oldest_meet);
+        }
+
+        return Error::OK;
+    }
+
+
     void OnSessionBegin() {
 
     }
@@ -627,20 +2244,65 @@ private:
     }
 
     void OnFrameBegin() {
-
+        frame_tokens_created_ = stats_.num_tokens_created;
+        frame_arcs_visited_ = stats_.num_arcs_visited;
+        if (config_.adaptive_frame_budget_ms > 0.0) {
+            frame_begin_cpu_ms_ = ThreadCpuMs();
+        }
     }
 
     void OnFrameEnd() {
+        i64 num_token_sets = lattice_.back().size();
+        i64 num_tokens_created = stats_.num_tokens_created - frame_tokens_created_;
+        i64 num_arcs_visited = stats_.num_arcs_visited - frame_arcs_visited_;
+        f32 effective_beam = score_max_ - score_cutoff_;
+
+        stats_.num_frames++;
+        stats_.active_token_sets.Add(num_token_sets);
+        stats_.tokens_created.Add(num_tokens_created);
+        stats_.arcs_visited.Add(num_arcs_visited);
+        stats_.effective_beam.Add(effective_beam);
+        stats_.retained_slabs.Add(token_allocator_.NumSlabs());
+
         if (config_.debug) {
-            printf("%d\t%f\t%f\t%d\n",
-                cur_time_,
-                score_max_,
-                score_max_ - score_cutoff_,
-                lattice_.back().size()
-            );
+            SIO_INFO << "frame:" << cur_time_
+                << " active_token_sets:" << num_token_sets
+                << " tokens_created:" << num_tokens_created
+                << " arcs_visited:" << num_arcs_visited
+                << " best_score:" << score_max_
+                << " effective_beam:" << effective_beam;
+        }
+
+        if (config_.adaptive_target_active > 0) {
+            AdaptBeam();
         }
     }
 
+
+    // Beam of next frame, assuming candidates' scores are roughly uniform within the spread:
+    //   1. over target, the beam holding adaptive_target_active candidates is spread * target / num_candidates,
+    //      under target, beam opens up towards config beam.
+    //      Beam shrinks to it at once to bound next frame's cost, but only opens up half way per frame.
+    //   2. over CPU time budget, beam shrinks proportionally, as frame cost is roughly linear to active count.
+    // Cutoff of pinned frame is tightened as well, because next frame's expansion inherits it.
+    void AdaptBeam() {
+        f32 target_beam = config_.beam;
+        if (frame_num_candidates_ > config_.adaptive_target_active) {
+            target_beam = std::min(frame_score_spread_, beam_) * config_.adaptive_target_active / frame_num_candidates_;
+        }
+        f32 beam = target_beam < beam_ ? target_beam : 0.5 * (beam_ + target_beam);
+
+        if (config_.adaptive_frame_budget_ms > 0.0) {
+            f64 cpu_ms = ThreadCpuMs() - frame_begin_cpu_ms_;
+            if (cpu_ms > config_.adaptive_frame_budget_ms) {
+                beam = std::min<f32>(beam, beam_ * config_.adaptive_frame_budget_ms / cpu_ms);
+            }
+        }
+
+        beam_ = std::max(config_.adaptive_min_beam, std::min(config_.beam, beam));
+        score_cutoff_ = std::max(score_cutoff_, score_max_ - beam_);
+    }
+
 }; // class BeamSearch
 }  // namespace sio
 #endif
@@ -0,0 +1,686 @@
+#include <stdio.h>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <fstream>
+#include <sstream>
+
+#include "sio/search.h"
+
+namespace sio {
+
+using Clock = std::chrono::steady_clock;
+
+
+// Synthetic CTC log-posteriors [num_frames, vocab]:
+//   blank-dominated frames with probability blank_ratio, otherwise a random token peaks.
+static Vec<Vec<f32>> SyntheticPosteriors(const Tokenizer& tokenizer, int num_frames, f32 blank_ratio, u32 seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<f32> uniform(0.0, 1.0);
+    std::uniform_int_distribution<TokenId> random_token(0, tokenizer.Size() - 1);
+
+    int vocab = tokenizer.Size();
+    Vec<Vec<f32>> posteriors(num_frames, Vec<f32>(vocab));
+    for (auto& frame : posteriors) {
+        bool blank_frame = uniform(rng) < blank_ratio;
+        TokenId peak_token = blank_frame ? tokenizer.blk : random_token(rng);
+        f32 peak = blank_frame ? 0.98 + 0.0199 * uniform(rng) : 0.6 + 0.39 * uniform(rng);
+        for (TokenId t = 0; t != vocab; t++) {
+            f32 p = (t == peak_token) ? peak : (1.0 - peak) * (0.5 + uniform(rng)) / vocab;
+            frame[t] = log(p);
+        }
+    }
+    return posteriors;
+}
+
+
+// Token-level Levenshtein distance
+static int EditDistance(const Vec<TokenId>& x, const Vec<TokenId>& y) {
+    Vec<int> d(y.size() + 1);
+    for (int j = 0; j <= y.size(); j++) d[j] = j;
+    for (int i = 1; i <= x.size(); i++) {
+        int diag = d[0];
+        d[0] = i;
+        for (int j = 1; j <= y.size(); j++) {
+            int up = d[j];
+            d[j] = std::min({d[j] + 1, d[j - 1] + 1, diag + (x[i - 1] != y[j - 1])});
+            diag = up;
+        }
+    }
+    return d[y.size()];
+}
+
+// Compares nth_element & histogram based max_active pruning on synthetic frontiers
+static void BenchFrontierPrune() {
+    constexpr int num_frontiers = 16;
+    constexpr int num_repeats = 200;
+    constexpr f32 beam = 16.0;
+
+    printf("%-12s%-12s%-16s%-16s%-16s\n", "max_active", "frontier", "nth_element(us)", "histogram(us)", "speedup");
+    for (int max_active : {100, 1000, 5000, 20000}) {
+        std::mt19937 rng(max_active);
+        std::normal_distribution<f32> normal(-beam / 2, beam / 4);
+
+        // frontier is normally a few times larger than max_active before pruning
+        int frontier_size = 3 * max_active;
+        Vec<Vec<TokenSet<1>>> frontiers(num_frontiers, Vec<TokenSet<1>>(frontier_size));
+        Vec<f32> max_scores;
+        for (auto& frontier : frontiers) {
+            for (int k = 0; k != frontier.size(); k++) {
+                frontier[k].handle = k;
+                frontier[k].best_score = std::min(normal(rng), 0.0f);
+            }
+            max_scores.push_back(std::min_element(frontier.begin(), frontier.end(), TokenSetBetterThan<1>)->best_score);
+        }
+
+        Vec<TokenSet<1>> x;
+        Vec<int> histogram(64);
+        Clock::duration nth_elapsed(0), hist_elapsed(0);
+
+        for (int r = 0; r != num_repeats; r++) {
+            int i = r % num_frontiers;
+
+            x = frontiers[i];
+            auto t0 = Clock::now();
+            f32 nth_cutoff = NthElementPrune(&x, max_active).best_score;
+            nth_elapsed += Clock::now() - t0;
+
+            x = frontiers[i];
+            t0 = Clock::now();
+            f32 hist_cutoff = HistogramPrune(&x, max_active, max_scores[i], beam, &histogram).best_score;
+            hist_elapsed += Clock::now() - t0;
+
+            SIO_CHECK_EQ(nth_cutoff, hist_cutoff); // both should yield the same cutoff
+        }
+
+        f64 nth_us = std::chrono::duration<f64, std::micro>(nth_elapsed).count() / num_repeats;
+        f64 hist_us = std::chrono::duration<f64, std::micro>(hist_elapsed).count() / num_repeats;
+        printf("%-12d%-12d%-16.2f%-16.2f%-16.2f\n", max_active, frontier_size, nth_us, hist_us, nth_us / hist_us);
+    }
+}
+
+
+struct DecodeStats {
+    f64 frames_per_sec = 0.0;
+    f64 skipped_frames_ratio = 0.0;
+    f64 token_error_rate = 0.0;  // against references
+    SearchStats search;          // merged over all utts
+};
+
+
+// Decodes utts & measures against *references, fills references instead if it is empty.
+// MaxLms - 1 extra prefix tree LMs are added, so LM overhead is measured without LM files.
+template <int MaxLms = 1>
+static DecodeStats Decode(
+    const BeamSearchConfig& config, const Fsm& graph, const Tokenizer& tokenizer,
+    const Vec<Vec<Vec<f32>>>& utts, Vec<Vec<TokenId>>* references,
+    const Vec<std::pair<FsmLabel, const Fsm*>>& subgraphs = {}
+) {
+    BeamSearch<MaxLms> search;
+    search.Load(config, graph, tokenizer);
+    for (const auto& sub : subgraphs) {
+        search.SetSubgraph(sub.first, *sub.second);
+    }
+    for (int i = 1; i != MaxLms; i++) {
+        search.AddLm(std::make_unique<PrefixTreeLm>());
+    }
+
+    DecodeStats stats;
+    bool fill_references = references->empty();
+    i64 num_frames = 0, num_skipped = 0, num_errs = 0, num_ref_tokens = 0;
+    Clock::duration elapsed(0);
+    for (int u = 0; u != utts.size(); u++) {
+        auto t0 = Clock::now();
+        for (const auto& frame : utts[u]) {
+            search.Push(frame.data());
+        }
+        search.PushEos();
+        elapsed += Clock::now() - t0;
+
+        const Vec<TokenId>& best = search.NBest()[0];
+        if (fill_references) {
+            references->push_back(best);
+        }
+        num_errs += EditDistance((*references)[u], best);
+        num_ref_tokens += (*references)[u].size();
+        num_frames += utts[u].size();
+        num_skipped += search.Stats().num_blank_skipped_frames;
+        stats.search.Merge(search.Stats());
+
+        search.Reset();
+    }
+
+    stats.frames_per_sec = num_frames / std::chrono::duration<f64>(elapsed).count();
+    stats.skipped_frames_ratio = static_cast<f64>(num_skipped) / num_frames;
+    stats.token_error_rate = static_cast<f64>(num_errs) / num_ref_tokens;
+    return stats;
+}
+
+
+// Large-vocab CTC topology with synthetic posteriors, optimizations are measured against full expansion
+static void BenchCtcExpansion() {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/model/tokenizer.vocab");
+
+    Fsm graph;
+    graph.BuildTokenTopology(tokenizer);
+
+    Vec<Vec<Vec<f32>>> utts;
+    for (int u = 0; u != 10; u++) {
+        utts.push_back(SyntheticPosteriors(tokenizer, 500, 0.8, u));
+    }
+
+    BeamSearchConfig config;
+    config.beam = 16.0;
+    config.max_active = 64;
+    config.token_set_size = 1;
+
+    Vec<Vec<TokenId>> references;
+    Decode(config, graph, tokenizer, utts, &references);
+
+    printf("%-24s%-16s%-16s%-16s\n", "config", "frames/sec", "skipped(%)", "token_err(%)");
+    auto report = [&](const char* name, const BeamSearchConfig& c) {
+        DecodeStats stats = Decode(c, graph, tokenizer, utts, &references);
+        printf("%-24s%-16.0f%-16.2f%-16.2f\n",
+            name, stats.frames_per_sec, 100.0 * stats.skipped_frames_ratio, 100.0 * stats.token_error_rate
+        );
+    };
+
+    report("full expansion", config);
+
+    for (f32 threshold : {0.999, 0.99, 0.95, 0.9}) {
+        BeamSearchConfig c = config;
+        c.blank_skip_threshold = threshold;
+        report(absl::StrFormat("blank_skip=%.3f", threshold).c_str(), c);
+    }
+
+    for (int k : {256, 64, 16, 4}) {
+        BeamSearchConfig c = config;
+        c.label_topk = k;
+        report(absl::StrFormat("label_topk=%d", k).c_str(), c);
+    }
+
+    for (f32 label_beam : {16.0, 8.0}) {
+        BeamSearchConfig c = config;
+        c.label_beam = label_beam;
+        report(absl::StrFormat("label_beam=%.1f", label_beam).c_str(), c);
+    }
+}
+
+// Adds a nonterminal self-loop to start state: start --<eps>:nonterminal--> start
+static void AddNonterminalLoop(Fsm* graph, FsmLabel nonterminal) {
+    FsmArc arc;
+    arc.Set(graph->start_state, graph->start_state, kFsmEpsilon, nonterminal, 0.0);
+
+    // epsilon arcs come first in ilabel order
+    graph->arcs.insert(graph->arcs.begin() + graph->states[graph->start_state].arcs_offset, arc);
+    for (FsmStateId s = graph->start_state + 1; s != graph->states.size(); s++) {
+        graph->states[s].arcs_offset++;
+    }
+    graph->num_arcs++;
+}
+
+
+// 64-bit StateHandle & graph instance lookup shouldn't slow down single-graph decoding
+static void BenchMultiGraph() {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/model/tokenizer.vocab");
+
+    Fsm graph;
+    graph.BuildTokenTopology(tokenizer);
+
+    // main graph with a class slot at start state, class graph is another T
+    FsmLabel nonterminal = tokenizer.Size();
+    Fsm main_graph;
+    main_graph.BuildTokenTopology(tokenizer);
+    AddNonterminalLoop(&main_graph, nonterminal);
+
+    Fsm class_graph;
+    class_graph.BuildTokenTopology(tokenizer);
+
+    Vec<Vec<Vec<f32>>> utts;
+    for (int u = 0; u != 10; u++) {
+        utts.push_back(SyntheticPosteriors(tokenizer, 500, 0.8, u));
+    }
+
+    BeamSearchConfig config;
+    config.beam = 16.0;
+    config.max_active = 64;
+    config.token_set_size = 1;
+
+    printf("sizeof(StateHandle): %zu\n", sizeof(StateHandle));
+    printf("%-32s%-16s%-16s\n", "graphs", "frames/sec", "token_err(%)");
+
+    Vec<Vec<TokenId>> references;
+    Decode(config, graph, tokenizer, utts, &references);
+
+    DecodeStats stats = Decode(config, graph, tokenizer, utts, &references);
+    printf("%-32s%-16.0f%-16.2f\n", "single graph", stats.frames_per_sec, 100.0 * stats.token_error_rate);
+
+    stats = Decode(config, graph, tokenizer, utts, &references, {{nonterminal, &class_graph}});
+    printf("%-32s%-16.0f%-16.2f\n", "+ unreachable subgraph", stats.frames_per_sec, 100.0 * stats.token_error_rate);
+
+    stats = Decode(config, main_graph, tokenizer, utts, &references, {{nonterminal, &class_graph}});
+    printf("%-32s%-16.0f%-16.2f\n", "+ subgraph entered every frame", stats.frames_per_sec, 100.0 * stats.token_error_rate);
+}
+
+// Random HCLG-like graph: every state has fan_out emitting arcs with random labels & destinations,
+// plus an kFsmInputEnd arc to final state.
+static void BuildRandomGraph(int num_states, int fan_out, int vocab, u32 seed, Fsm* graph) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<FsmStateId> random_state(0, num_states - 1);
+    std::uniform_int_distribution<FsmLabel> random_label(1, vocab - 1);  // 0 is blank
+    std::uniform_real_distribution<f32> random_score(-2.0, 0.0);
+
+    graph->num_states = num_states + 1;
+    graph->start_state = 0;
+    graph->final_state = num_states;
+    graph->states.resize(graph->num_states + 1);
+
+    for (FsmStateId s = 0; s != num_states; s++) {
+        graph->states[s].arcs_offset = graph->arcs.size();
+
+        FsmArc arc;
+        arc.Set(s, graph->final_state, kFsmInputEnd, kFsmEpsilon, 0.0);
+        graph->arcs.push_back(arc);
+
+        arc.Set(s, s, 0, kFsmEpsilon, random_score(rng)); // blank self-loop
+        graph->arcs.push_back(arc);
+
+        for (int k = 1; k < fan_out; k++) {
+            FsmLabel label = random_label(rng);
+            arc.Set(s, random_state(rng), label, label, random_score(rng));
+            graph->arcs.push_back(arc);
+        }
+        std::sort(graph->arcs.begin() + graph->states[s].arcs_offset, graph->arcs.end(),
+            [](const FsmArc& x, const FsmArc& y) { return x.ilabel < y.ilabel; }
+        );
+    }
+    graph->states[num_states].arcs_offset = graph->arcs.size();
+    graph->states[num_states + 1].arcs_offset = graph->arcs.size();
+    graph->num_arcs = graph->arcs.size();
+}
+
+
+// Parallel emitting expansion on a large graph with wide beam, results should be identical,
+// speedup needs as many cores as expansion threads, see hardware threads
+static void BenchParallelExpansion() {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/model/tokenizer.vocab");
+
+    Fsm graph;
+    BuildRandomGraph(100000, 32, tokenizer.Size(), 1234, &graph);
+
+    Vec<Vec<Vec<f32>>> utts;
+    for (int u = 0; u != 2; u++) {
+        utts.push_back(SyntheticPosteriors(tokenizer, 200, 0.5, u));
+    }
+
+    BeamSearchConfig config;
+    config.beam = 16.0;
+    config.max_active = 4000;
+    config.token_set_size = 1;
+
+    printf("hardware threads: %u\n", std::thread::hardware_concurrency());
+    printf("%-24s%-16s%-16s\n", "expansion threads", "frames/sec", "token_err(%)");
+
+    Vec<Vec<TokenId>> references;
+    for (int num_threads : {1, 2, 4, 8}) {
+        BeamSearchConfig c = config;
+        c.num_expansion_threads = num_threads;
+        DecodeStats stats = Decode(c, graph, tokenizer, utts, &references);
+        printf("%-24d%-16.0f%-16.2f\n", num_threads, stats.frames_per_sec, 100.0 * stats.token_error_rate);
+    }
+}
+
+// Many short utterances on one long-lived search, token allocator slabs warm vs cold across sessions
+static void BenchSessionReuse() {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/model/tokenizer.vocab");
+
+    Fsm graph;
+    graph.BuildTokenTopology(tokenizer);
+
+    Vec<Vec<Vec<f32>>> utts;
+    for (int u = 0; u != 200; u++) {
+        utts.push_back(SyntheticPosteriors(tokenizer, 50, 0.8, u));
+    }
+
+    BeamSearchConfig config;
+    config.max_active = 64;
+    config.token_set_size = 8;
+    config.token_allocator_slab_size = 1024;
+
+    printf("%-24s%-16s\n", "max_retained_slabs", "frames/sec");
+    Vec<Vec<TokenId>> references;
+    for (int max_slabs : {0, 64}) {
+        BeamSearchConfig c = config;
+        c.token_allocator_max_retained_slabs = max_slabs;
+        DecodeStats stats = Decode(c, graph, tokenizer, utts, &references);
+        printf("%-24d%-16.0f\n", max_slabs, stats.frames_per_sec);
+    }
+}
+
+
+// Fixed vs adaptive beam on clean & noisy posteriors, adaptive beam should bound active set on noise
+static void BenchAdaptiveBeam() {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/model/tokenizer.vocab");
+
+    Fsm graph;
+    graph.BuildTokenTopology(tokenizer);
+
+    Vec<Vec<Vec<f32>>> clean, noisy;
+    for (int u = 0; u != 10; u++) {
+        clean.push_back(SyntheticPosteriors(tokenizer, 200, 0.8, u));
+        // noise: no label dominates, scores spread over a few nats
+        std::mt19937 rng(u);
+        std::uniform_real_distribution<f32> uniform(-6.0, 0.0);
+        noisy.emplace_back(200, Vec<f32>(tokenizer.Size()));
+        for (auto& frame : noisy.back()) {
+            for (auto& x : frame) x = uniform(rng);
+        }
+    }
+
+    BeamSearchConfig config;
+    config.beam = 16.0;
+    config.max_active = 100000;
+    config.token_set_size = 1;
+
+    printf("%-32s%-12s%-12s%-12s%-12s%-12s\n", "config", "frames/sec", "active(p50)", "active(p99)", "beam(p50)", "token_err(%)");
+    auto run = [&](const char* name, const BeamSearchConfig& c, const Vec<Vec<Vec<f32>>>& utts, Vec<Vec<TokenId>>* references) {
+        DecodeStats s = Decode(c, graph, tokenizer, utts, references);
+        printf("%-32s%-12.0f%-12.0f%-12.0f%-12.1f%-12.2f\n", name, s.frames_per_sec,
+            s.search.active_token_sets.Quantile(0.5), s.search.active_token_sets.Quantile(0.99),
+            s.search.effective_beam.Quantile(0.5), 100.0 * s.token_error_rate
+        );
+    };
+
+    BeamSearchConfig adaptive = config;
+    adaptive.adaptive_target_active = 64;
+    adaptive.adaptive_min_beam = 0.5;
+
+    BeamSearchConfig budget = adaptive;
+    budget.adaptive_frame_budget_ms = 0.1;
+
+    Vec<Vec<TokenId>> clean_refs, noisy_refs;
+    run("clean, fixed", config, clean, &clean_refs);
+    run("clean, adaptive", adaptive, clean, &clean_refs);
+    run("clean, adaptive + 0.1ms budget", budget, clean, &clean_refs);
+    run("noisy, fixed", config, noisy, &noisy_refs);
+    run("noisy, adaptive", adaptive, noisy, &noisy_refs);
+    run("noisy, adaptive + 0.1ms budget", budget, noisy, &noisy_refs);
+}
+
+// N-best via wide token sets vs via word lattice over narrow token sets
+static void BenchLatticeNBest() {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/model/tokenizer.vocab");
+
+    Fsm graph;
+    graph.BuildTokenTopology(tokenizer);
+
+    Vec<Vec<Vec<f32>>> utts;
+    for (int u = 0; u != 10; u++) {
+        utts.push_back(SyntheticPosteriors(tokenizer, 200, 0.8, u));
+    }
+
+    BeamSearchConfig config;
+    config.beam = 16.0;
+    config.max_active = 64;
+    config.nbest = 10;
+
+    auto nbest_of = [&](const BeamSearchConfig& c, f64* frames_per_sec) {
+        BeamSearch<> search;
+        search.Load(c, graph, tokenizer);
+
+        Vec<Vec<Vec<TokenId>>> nbests;
+        i64 num_frames = 0;
+        Clock::duration elapsed(0);
+        for (const auto& utt : utts) {
+            auto t0 = Clock::now();
+            for (const auto& frame : utt) {
+                search.Push(frame.data());
+            }
+            search.PushEos();
+            nbests.push_back(search.NBest());
+            elapsed += Clock::now() - t0;
+
+            num_frames += utt.size();
+            search.Reset();
+        }
+        *frames_per_sec = num_frames / std::chrono::duration<f64>(elapsed).count();
+        return nbests;
+    };
+
+    printf("%-32s%-12s%-12s%-16s\n", "config", "frames/sec", "nbest", "in reference(%)");
+    BeamSearchConfig wide = config;
+    wide.token_set_size = 64;
+    f64 frames_per_sec = 0.0;
+    Vec<Vec<Vec<TokenId>>> reference = nbest_of(wide, &frames_per_sec);
+
+    auto report = [&](const char* name, const BeamSearchConfig& c) {
+        Vec<Vec<Vec<TokenId>>> nbests = nbest_of(c, &frames_per_sec);
+        i64 n = 0, hits = 0;
+        for (int u = 0; u != nbests.size(); u++) {
+            for (const auto& path : nbests[u]) {
+                n++;
+                hits += std::find(reference[u].begin(), reference[u].end(), path) != reference[u].end();
+            }
+        }
+        printf("%-32s%-12.0f%-12.1f%-16.2f\n", name, frames_per_sec, static_cast<f64>(n) / nbests.size(), 100.0 * hits / n);
+    };
+
+    report("token_set_size=64", wide);
+    for (int token_set_size : {1, 4}) {
+        BeamSearchConfig c = config;
+        c.token_set_size = token_set_size;
+        report(absl::StrFormat("token_set_size=%d", token_set_size).c_str(), c);
+
+        c.lattice_beam = 32.0;
+        report(absl::StrFormat("token_set_size=%d, lattice", token_set_size).c_str(), c);
+    }
+}
+
+// Session handover cost: snapshot & restore time / size of a session in the middle of a long stream
+static void BenchSnapshotRestore() {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/model/tokenizer.vocab");
+
+    Fsm graph;
+    graph.BuildTokenTopology(tokenizer);
+
+    Vec<Vec<f32>> utt = SyntheticPosteriors(tokenizer, 1500, 0.8, 0); // 60 seconds with subsampling 4
+
+    BeamSearchConfig config;
+    config.beam = 16.0;
+    config.max_active = 64;
+    config.token_set_size = 4;
+    config.token_gc_interval = 50;
+
+    printf("%-40s%-12s%-16s%-16s\n", "config", "bytes", "snapshot(ms)", "restore(ms)");
+    auto run = [&](const char* name, const BeamSearchConfig& c) {
+        BeamSearch<> src, dst;
+        src.Load(c, graph, tokenizer);
+        dst.Load(c, graph, tokenizer);
+        for (const auto& frame : utt) {
+            src.Push(frame.data());
+        }
+
+        const int n = 20;
+        Str bytes;
+        Clock::duration snapshot_elapsed(0), restore_elapsed(0);
+        for (int i = 0; i != n; i++) {
+            auto t0 = Clock::now();
+            bytes.clear();
+            SnapshotWriter w(&bytes);
+            src.Snapshot(&w);
+            auto t1 = Clock::now();
+            SnapshotReader r(bytes.data(), bytes.size());
+            SIO_CHECK(dst.Restore(&r) == Error::OK);
+            auto t2 = Clock::now();
+            dst.Reset();
+
+            snapshot_elapsed += t1 - t0;
+            restore_elapsed += t2 - t1;
+        }
+        printf("%-40s%-12zu%-16.3f%-16.3f\n", name, bytes.size(),
+            std::chrono::duration<f64, std::milli>(snapshot_elapsed).count() / n,
+            std::chrono::duration<f64, std::milli>(restore_elapsed).count() / n
+        );
+    };
+
+    run("token_set_size=4", config);
+    for (f32 lattice_beam : {4.0, 8.0}) {
+        BeamSearchConfig c = config;
+        c.token_set_size = 1;
+        c.lattice_beam = lattice_beam;
+        run(absl::StrFormat("token_set_size=1, lattice_beam=%.0f", lattice_beam).c_str(), c);
+    }
+}
+
+// Recorded CTC log-posteriors in text: one frame per line, utterances separated by empty lines
+static Vec<Vec<Vec<f32>>> LoadPosteriors(const Str& path) {
+    std::ifstream is(path);
+    SIO_CHECK(is.good());
+
+    Vec<Vec<Vec<f32>>> utts(1);
+    Str line;
+    while (std::getline(is, line)) {
+        Vec<Str> cols = absl::StrSplit(line, absl::ByAnyChar(" \t"), absl::SkipWhitespace());
+        if (cols.empty()) {
+            if (!utts.back().empty()) utts.emplace_back();
+            continue;
+        }
+        Vec<f32> frame(cols.size());
+        for (int k = 0; k != cols.size(); k++) {
+            SIO_CHECK(absl::SimpleAtof(cols[k], &frame[k]));
+        }
+        SIO_CHECK(utts.back().empty() || utts.back().back().size() == frame.size());
+        utts.back().push_back(std::move(frame));
+    }
+    if (utts.back().empty()) utts.pop_back();
+    SIO_CHECK(!utts.empty());
+    return utts;
+}
+
+
+// Tokenizer of the first vocab tokens from testdata, special tokens come first there
+static void LoadTokenizer(int vocab, Tokenizer* tokenizer) {
+    std::ifstream is("testdata/model/tokenizer.vocab");
+    SIO_CHECK(is.good());
+
+    std::stringstream head;
+    Str line;
+    for (int k = 0; k != vocab && std::getline(is, line); k++) {
+        head << line << "\n";
+    }
+    tokenizer->Load(head);
+    SIO_CHECK_EQ(tokenizer->Size(), vocab);
+}
+
+
+/*
+ * Search-only regression suite, no neural net involved:
+ *   posteriors are synthetic by default, or recorded ones if given (vocab sweep is skipped then).
+ *   each sweep varies one knob of a base config, results are compared against base config's outputs.
+ */
+static void BenchSearchSweep(const Vec<Vec<Vec<f32>>>& recorded) {
+    BeamSearchConfig base;
+    base.beam = 16.0;
+    base.max_active = 64;
+    base.token_set_size = 1;
+
+    printf("%-24s%-12s%-14s%-12s%-12s%-14s%-12s%-12s\n",
+        "config", "frames/sec", "tokens/frame", "arcs/frame", "lm/frame", "retained(max)", "gc", "token_err(%)"
+    );
+    auto report = [](const Str& name, const DecodeStats& s) {
+        f64 num_frames = std::max<i64>(s.search.num_frames, 1);
+        printf("%-24s%-12.0f%-14.1f%-12.1f%-12.1f%-14.0f%-12lld%-12.2f\n",
+            name.c_str(), s.frames_per_sec,
+            s.search.num_tokens_created / num_frames,
+            s.search.num_arcs_visited / num_frames,
+            s.search.num_lm_calls / num_frames,
+            s.search.retained_slabs.Max(),
+            static_cast<long long>(s.search.num_gc),
+            100.0 * s.token_error_rate
+        );
+    };
+
+    auto synthetic = [](const Tokenizer& tokenizer) {
+        Vec<Vec<Vec<f32>>> utts;
+        for (int u = 0; u != 10; u++) {
+            utts.push_back(SyntheticPosteriors(tokenizer, 500, 0.8, u));
+        }
+        return utts;
+    };
+
+    if (recorded.empty()) {
+        for (int vocab : {256, 1024, 4096}) {
+            Tokenizer tokenizer;
+            LoadTokenizer(vocab, &tokenizer);
+            Fsm graph;
+            graph.BuildTokenTopology(tokenizer);
+
+            Vec<Vec<TokenId>> references;
+            report(absl::StrFormat("vocab=%d", vocab), Decode(base, graph, tokenizer, synthetic(tokenizer), &references));
+        }
+    }
+
+    Tokenizer tokenizer;
+    LoadTokenizer(recorded.empty() ? 4096 : recorded[0][0].size(), &tokenizer);
+    Fsm graph;
+    graph.BuildTokenTopology(tokenizer);
+    const Vec<Vec<Vec<f32>>> utts = recorded.empty() ? synthetic(tokenizer) : recorded;
+
+    Vec<Vec<TokenId>> references;
+    report("base", Decode(base, graph, tokenizer, utts, &references));
+
+    for (f32 beam : {4.0, 8.0, 32.0}) {
+        BeamSearchConfig c = base;
+        c.beam = beam;
+        report(absl::StrFormat("beam=%.1f", beam), Decode(c, graph, tokenizer, utts, &references));
+    }
+
+    for (int max_active : {16, 256, 1024}) {
+        BeamSearchConfig c = base;
+        c.max_active = max_active;
+        report(absl::StrFormat("max_active=%d", max_active), Decode(c, graph, tokenizer, utts, &references));
+    }
+
+    for (int token_set_size : {4, 16}) {
+        BeamSearchConfig c = base;
+        c.token_set_size = token_set_size;
+        report(absl::StrFormat("token_set_size=%d", token_set_size), Decode(c, graph, tokenizer, utts, &references));
+    }
+
+    report("lms=2", Decode<2>(base, graph, tokenizer, utts, &references));
+    report("lms=4", Decode<4>(base, graph, tokenizer, utts, &references));
+}
+
+} // namespace sio
+
+
+// Usage: bench [posteriors.txt]
+//   posteriors.txt: recorded CTC log-posteriors for search sweep, in the format of LoadPosteriors()
+int main(int argc, char* argv[]) {
+    sio::Vec<sio::Vec<sio::Vec<sio::f32>>> recorded;
+    if (argc > 1) {
+        recorded = sio::LoadPosteriors(argv[1]);
+    }
+
+    sio::BenchSearchSweep(recorded);
+    if (!recorded.empty()) {
+        return 0; // recorded posteriors are for search sweep only
+    }
+
+    sio::BenchFrontierPrune();
+    sio::BenchCtcExpansion();
+    sio::BenchMultiGraph();
+    sio::BenchParallelExpansion();
+    sio::BenchSessionReuse();
+    sio::BenchAdaptiveBeam();
+    sio::BenchLatticeNBest();
+    sio::BenchSnapshotRestore();
+    return 0;
+}
@@ -0,0 +1,989 @@
+#include "sio/search.h"
+
+#include <math.h>
+#include <random>
+#include <sstream>
+
+#include <torch/torch.h>
+#include <gtest/gtest.h>
+
+namespace sio {
+
+// synthetic CTC log-posteriors: [num_frames, vocab_size], blank dominated
+static Vec<Vec<f32>> SyntheticScores(const Tokenizer& tokenizer, int num_frames, u32 seed = 1234) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<f32> uniform(0.0, 1.0);
+
+    Vec<Vec<f32>> scores(num_frames, Vec<f32>(tokenizer.Size(), 0.0));
+    for (auto& frame : scores) {
+        f32 sum = 0.0;
+        for (TokenId t = 0; t != frame.size(); t++) {
+            frame[t] = uniform(rng) * (t == tokenizer.blk ? 4.0 : 1.0);
+            sum += frame[t];
+        }
+        for (auto& x : frame) {
+            x = log(x / sum);
+        }
+    }
+    return scores;
+}
+
+
+// synthetic vocab of realistic size: special tokens + num_tokens tokens, so that search actually prunes
+static void LoadSyntheticTokenizer(int num_tokens, Tokenizer* tokenizer) {
+    std::stringstream vocab;
+    vocab << "<blk> 0\n<unk> 0\n<s> 0\n</s> 0\n";
+    for (int k = 0; k != num_tokens; k++) {
+        vocab << "t" << k << " -1.0\n";
+    }
+    tokenizer->Load(vocab);
+}
+
+
+// synthetic CTC log-posteriors peaked like real ones: blank_ratio of frames are confident blanks,
+// others peak at a random non-special token, the rest of mass is spread over the vocab
+static Vec<Vec<f32>> SyntheticPosteriors(const Tokenizer& tokenizer, int num_frames, f32 blank_ratio, u32 seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<f32> uniform(0.0, 1.0);
+    std::uniform_int_distribution<TokenId> random_token(4, tokenizer.Size() - 1); // after special tokens
+
+    int vocab = tokenizer.Size();
+    Vec<Vec<f32>> posteriors(num_frames, Vec<f32>(vocab));
+    for (auto& frame : posteriors) {
+        bool blank_frame = uniform(rng) < blank_ratio;
+        TokenId peak_token = blank_frame ? tokenizer.blk : random_token(rng);
+        f32 peak = blank_frame ? 0.9 + 0.09 * uniform(rng) : 0.3 + 0.6 * uniform(rng);
+        for (TokenId t = 0; t != vocab; t++) {
+            f32 p = (t == peak_token) ? peak : (1.0 - peak) * (0.5 + uniform(rng)) / vocab;
+            frame[t] = log(p);
+        }
+    }
+    return posteriors;
+}
+
+
+template <int MaxLms>
+static Vec<Vec<TokenId>> Decode(BeamSearch<MaxLms>* search, Vec<Vec<f32>>& scores) {
+    for (auto& frame : scores) {
+        search->Push(torch::from_blob(frame.data(), {static_cast<long>(frame.size())}, torch::kFloat));
+    }
+    search->PushEos();
+    return search->NBest();
+}
+
+
+// Fsm from text, see Fsm::LoadFromText()
+static void BuildFsm(const char* text, Fsm* fsm) {
+    std::istringstream is(text);
+    fsm->LoadFromText(is);
+}
+
+
+TEST(BeamSearch, TokenLayout) {
+    // on 64-bit platforms
+    EXPECT_LE(sizeof(Token<1>), 40);
+    EXPECT_LT(sizeof(Token<1>), sizeof(Token<SIO_MAX_LM>));
+}
+
+
+TEST(BeamSearch, HistogramPrune) {
+    std::mt19937 rng(777);
+    std::normal_distribution<f32> normal(-5.0, 3.0);
+
+    Vec<TokenSet<1>> token_sets(1000);
+    for (int k = 0; k != token_sets.size(); k++) {
+        token_sets[k].handle = k;
+        token_sets[k].best_score = (k % 10 == 0) ? -3.0 : normal(rng); // with ties
+    }
+    f32 max_score = std::max_element(token_sets.begin(), token_sets.end(), TokenSetBetterThan<1>)->best_score;
+
+    Vec<int> histogram(32);
+    for (int max_active : {1, 7, 100, 500, 999, 1000}) {
+        Vec<TokenSet<1>> x = token_sets;
+        Vec<TokenSet<1>> y = token_sets;
+
+        f32 nth_score = NthElementPrune(&x, max_active).best_score;
+        f32 hist_score = HistogramPrune(&y, max_active, max_score, 16.0, &histogram).best_score;
+        EXPECT_EQ(nth_score, hist_score);
+
+        Vec<StateHandle> hx, hy;
+        for (int k = 0; k != max_active; k++) {
+            hx.push_back(x[k].handle);
+            hy.push_back(y[k].handle);
+        }
+        std::sort(hx.begin(), hx.end());
+        std::sort(hy.begin(), hy.end());
+        EXPECT_EQ(hx, hy);
+    }
+}
+
+
+// End to end: histogram pruning keeps exactly the same survivors as nth_element, so same search
+TEST(BeamSearch, HistogramPruneSearch) {
+    Tokenizer tokenizer;
+    LoadSyntheticTokenizer(1000, &tokenizer);
+
+    Fsm graph;
+    graph.BuildTokenTopology(tokenizer);
+
+    Vec<Vec<f32>> scores = SyntheticPosteriors(tokenizer, 200, 0.5, 1234);
+
+    BeamSearchConfig config;
+    config.beam = 12.0;
+    config.max_active = 16;
+    config.token_set_size = 2;
+    config.nbest = 4;
+
+    BeamSearch<> search;
+    search.Load(config, graph, tokenizer);
+    Vec<Vec<TokenId>> nbest = Decode(&search, scores);
+    const SearchStats& x = search.Stats();
+    EXPECT_EQ(x.active_token_sets.Max(), config.max_active); // max_active pruning does bite
+
+    for (int bins : {8, 64, 1024}) {
+        config.histogram_bins = bins;
+        BeamSearch<> hist_search;
+        hist_search.Load(config, graph, tokenizer);
+        EXPECT_EQ(Decode(&hist_search, scores), nbest);
+
+        const SearchStats& y = hist_search.Stats();
+        EXPECT_EQ(y.num_tokens_created, x.num_tokens_created);
+        EXPECT_EQ(y.num_arcs_visited, x.num_arcs_visited);
+        EXPECT_EQ(y.active_token_sets.Sum(), x.active_token_sets.Sum());
+        hist_search.Reset();
+    }
+    search.Reset();
+}
+
+
+TEST(BeamSearch, TokenGarbageCollection) {
+    Tokenizer tokenizer;
+    LoadSyntheticTokenizer(1000, &tokenizer);
+
+    Fsm graph;
+    graph.BuildTokenTopology(tokenizer);
+
+    Vec<Vec<f32>> scores = SyntheticPosteriors(tokenizer, 1000, 0.5, 1234);
+
+    BeamSearchConfig config;
+    config.beam = 12.0;
+    config.max_active = 4;
+    config.token_set_size = 4;
+    config.nbest = 4;
+
+    config.token_gc_interval = 0;
+    BeamSearch<> search;
+    search.Load(config, graph, tokenizer);
+    Vec<Vec<TokenId>> nbest = Decode(&search, scores);
+    size_t num_tokens = search.NumLiveTokens();
+    EXPECT_EQ(search.Stats().num_gc, 0);
+    EXPECT_EQ(search.Stats().active_token_sets.Max(), config.max_active); // pruned hypotheses leave garbage behind
+    EXPECT_GT(nbest.size(), 1);
+
+    config.token_gc_interval = 10;
+    BeamSearch<> gc_search;
+    gc_search.Load(config, graph, tokenizer);
+    Vec<Vec<TokenId>> gc_nbest = Decode(&gc_search, scores);
+    size_t gc_num_tokens = gc_search.NumLiveTokens();
+    EXPECT_EQ(gc_search.Stats().num_gc, 100);
+    EXPECT_GT(gc_search.Stats().num_gc_reclaimed_tokens, 0);
+
+    EXPECT_EQ(nbest, gc_nbest); // GC should never change search result
+    EXPECT_LT(gc_num_tokens, num_tokens);
+
+    search.Reset();
+    gc_search.Reset();
+    EXPECT_EQ(gc_search.NumLiveTokens(), 0);
+}
+
+
+TEST(BeamSearch, PartialResult) {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/tokenizer.vocab");
+
+    Fsm graph;
+    graph.BuildTokenTopology(tokenizer);
+
+    Vec<Vec<f32>> scores = SyntheticScores(tokenizer, 500);
+
+    BeamSearchConfig config;
+    config.max_active = 4;
+    config.token_set_size = 4;
+    config.token_gc_interval = 7;
+
+    BeamSearch<> search;
+    search.Load(config, graph, tokenizer);
+
+    Vec<TokenId> stable;
+    for (auto& frame : scores) {
+        search.Push(torch::from_blob(frame.data(), {static_cast<long>(frame.size())}, torch::kFloat));
+
+        const Vec<TokenId>& partial = search.PartialResult();
+        ASSERT_LE(search.NumStableTokens(), partial.size());
+        ASSERT_GE(search.NumStableTokens(), stable.size());
+        // stable prefix only grows, never changes
+        EXPECT_TRUE(std::equal(stable.begin(), stable.end(), partial.begin()));
+        stable.assign(partial.begin(), partial.begin() + search.NumStableTokens());
+    }
+    EXPECT_GT(stable.size(), 1);
+
+    search.PushEos();
+    const Vec<TokenId>& best = search.NBest()[0];
+    ASSERT_LE(stable.size(), best.size());
+    EXPECT_TRUE(std::equal(stable.begin(), stable.end(), best.begin()));
+
+    search.Reset();
+}
+
+
+// Leading blank frames recognize nothing, though partial result is never empty (bos of initial token),
+// see SpeechToText's first partial latency
+TEST(BeamSearch, FirstPartialAfterLeadingBlanks) {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/tokenizer.vocab");
+
+    Fsm graph;
+    graph.BuildTokenTopology(tokenizer);
+
+    auto frame_of = [&](TokenId best) {
+        Vec<f32> frame(tokenizer.Size(), -20.0);
+        frame[best] = 0.0;
+        return frame;
+    };
+    Vec<Vec<f32>> scores(30, frame_of(tokenizer.blk));
+    TokenId a = tokenizer.Index("a");
+    scores.push_back(frame_of(a));
+
+    BeamSearchConfig config;
+    BeamSearch<> search;
+    search.Load(config, graph, tokenizer);
+
+    int first_partial_frame = -1;
+    for (int f = 0; f != scores.size(); f++) {
+        search.Push(scores[f].data());
+        const Vec<TokenId>& partial = search.PartialResult();
+        EXPECT_FALSE(partial.empty());
+        if (first_partial_frame == -1 && HasRecognizedToken(partial, tokenizer)) {
+            first_partial_frame = f;
+        }
+    }
+    EXPECT_EQ(first_partial_frame, 30); // no first partial over blanks
+    EXPECT_EQ(search.PartialResult().back(), a);
+
+    search.PushEos();
+    search.Reset();
+}
+
+
+TEST(BeamSearch, BlankSkip) {
+    Tokenizer tokenizer;
+    LoadSyntheticTokenizer(1000, &tokenizer);
+
+    Fsm graph;
+    graph.BuildTokenTopology(tokenizer);
+
+    Vec<Vec<f32>> scores = SyntheticPosteriors(tokenizer, 300, 0.7, 1234);
+
+    BeamSearchConfig config;
+    config.beam = 12.0;
+    config.max_active = 16;
+    config.token_set_size = 2;
+
+    // reference: every frame fully expanded
+    BeamSearch<> ref_search;
+    ref_search.Load(config, graph, tokenizer);
+    Vec<Vec<TokenId>> ref_nbest = Decode(&ref_search, scores);
+    EXPECT_EQ(ref_search.Stats().active_token_sets.Max(), config.max_active);
+
+    config.blank_skip_threshold = 0.8;
+    int num_blank_frames = 0;
+    for (const auto& frame : scores) {
+        num_blank_frames += (frame[tokenizer.blk] > log(config.blank_skip_threshold));
+    }
+    ASSERT_GT(num_blank_frames, 0);
+    ASSERT_LT(num_blank_frames, scores.size());
+
+    BeamSearch<> search;
+    search.Load(config, graph, tokenizer);
+    Vec<Vec<TokenId>> nbest = Decode(&search, scores);
+    EXPECT_EQ(search.Stats().num_blank_skipped_frames, num_blank_frames);
+    ASSERT_EQ(nbest.size(), 1);
+    EXPECT_EQ(nbest[0].front(), tokenizer.bos);
+    EXPECT_EQ(nbest[0].back(), tokenizer.eos);
+
+    // confident blanks don't change best path, at a fraction of the cost
+    EXPECT_GT(nbest[0].size(), 20);
+    EXPECT_EQ(nbest[0], ref_nbest[0]);
+    EXPECT_LT(search.Stats().num_arcs_visited, ref_search.Stats().num_arcs_visited / 2);
+
+    search.Reset();
+    ref_search.Reset();
+}
+
+
+TEST(BeamSearch, LabelPrePruning) {
+    Tokenizer tokenizer;
+    LoadSyntheticTokenizer(1000, &tokenizer);
+
+    Fsm graph;
+    graph.BuildTokenTopology(tokenizer);
+
+    Vec<Vec<f32>> scores = SyntheticPosteriors(tokenizer, 200, 0.5, 1234);
+    for (auto& frame : scores) { // these are not input labels of token topology
+        frame[tokenizer.unk] = frame[tokenizer.bos] = frame[tokenizer.eos] = -1.0e10;
+    }
+
+    BeamSearchConfig config;
+    config.beam = 12.0;
+    config.max_active = 16;
+    config.token_set_size = 2;
+    config.nbest = 2;
+
+    BeamSearch<> full_search;
+    full_search.Load(config, graph, tokenizer);
+    Vec<Vec<TokenId>> full_nbest = Decode(&full_search, scores);
+    EXPECT_EQ(full_search.Stats().active_token_sets.Max(), config.max_active);
+
+    // reference: unselected labels are masked out by very low scores
+    auto decode_masked = [&](int topk, f32 label_beam) {
+        Vec<Vec<f32>> masked = scores;
+        for (auto& frame : masked) {
+            Vec<f32> sorted = frame;
+            std::sort(sorted.begin(), sorted.end(), std::greater<f32>());
+            f32 cutoff = (topk > 0) ? sorted[topk - 1] : -1.0e10;
+            if (label_beam > 0.0) {
+                cutoff = std::max(cutoff, sorted[0] - label_beam);
+            }
+            for (auto& x : frame) {
+                if (x < cutoff) x = -1.0e10;
+            }
+        }
+        BeamSearch<> ref_search;
+        ref_search.Load(config, graph, tokenizer);
+        return Decode(&ref_search, masked);
+    };
+
+    for (int topk : {1, 8, 64}) {
+        config.label_topk = topk;
+        BeamSearch<> search;
+        search.Load(config, graph, tokenizer);
+        Vec<Vec<TokenId>> nbest = Decode(&search, scores);
+        EXPECT_LT(search.Stats().num_arcs_visited, full_search.Stats().num_arcs_visited / 4);
+
+        config.label_topk = 0;
+        EXPECT_EQ(nbest, decode_masked(topk, 0.0));
+        if (topk == 64) { // peaked posteriors: best path survives pre-pruning
+            EXPECT_EQ(nbest[0], full_nbest[0]);
+        }
+    }
+
+    for (f32 label_beam : {2.0, 8.0}) {
+        config.label_beam = label_beam;
+        BeamSearch<> search;
+        search.Load(config, graph, tokenizer);
+        Vec<Vec<TokenId>> nbest = Decode(&search, scores);
+
+        config.label_beam = 0.0;
+        EXPECT_EQ(nbest, decode_masked(0, label_beam));
+    }
+
+    // no-op pruning
+    config.label_topk = tokenizer.Size();
+    config.label_beam = 1000.0;
+    BeamSearch<> search;
+    search.Load(config, graph, tokenizer);
+    EXPECT_EQ(Decode(&search, scores), full_nbest);
+}
+
+TEST(BeamSearch, MultiGraph) {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/tokenizer.vocab"); // a:4, b:5, </s>:3
+    ASSERT_EQ(tokenizer.Size(), 6);
+
+    // a (a|b) a, as a flat graph
+    Fsm flat;
+    BuildFsm(
+        "5,5,0,4\n"
+        "0 1 4:4/0.0\n"
+        "1 2 4:4/0.0\n"
+        "1 2 5:5/0.0\n"
+        "2 3 4:4/0.0\n"
+        "3 4 -1:3/0.0\n",
+        &flat
+    );
+
+    // a $CLASS a, with nonterminal $CLASS = 1000
+    Fsm main;
+    BuildFsm(
+        "5,4,0,4\n"
+        "0 1 4:4/0.0\n"
+        "1 2 -2147483648:1000/0.0\n"
+        "2 3 4:4/0.0\n"
+        "3 4 -1:3/0.0\n",
+        &main
+    );
+
+    Fsm a_or_b;
+    BuildFsm(
+        "3,3,0,2\n"
+        "0 1 4:4/0.0\n"
+        "0 1 5:5/0.0\n"
+        "1 2 -1:3/0.0\n",
+        &a_or_b
+    );
+
+    Fsm a;
+    BuildFsm(
+        "3,2,0,2\n"
+        "0 1 4:4/0.0\n"
+        "1 2 -1:3/0.0\n",
+        &a
+    );
+
+    Vec<Vec<f32>> scores(3, Vec<f32>(tokenizer.Size(), -1.0e10));
+    for (int k = 0; k != scores.size(); k++) {
+        scores[k][4] = log(k == 1 ? 0.3 : 0.6);
+        scores[k][5] = log(k == 1 ? 0.7 : 0.4);
+    }
+
+    BeamSearchConfig config;
+    config.token_set_size = 2;
+    config.nbest = 2;
+
+    BeamSearch<> flat_search;
+    flat_search.Load(config, flat, tokenizer);
+    Vec<Vec<TokenId>> flat_nbest = Decode(&flat_search, scores);
+    ASSERT_EQ(flat_nbest.size(), 2);
+    EXPECT_EQ(flat_nbest[0], Vec<TokenId>({2, 4, 5, 4, 3}));
+
+    BeamSearch<> search;
+    search.Load(config, main, tokenizer);
+    search.SetSubgraph(1000, a_or_b);
+    EXPECT_EQ(Decode(&search, scores), flat_nbest);
+    search.Reset();
+
+    // hot-switch subgraph between sessions
+    search.SetSubgraph(1000, a);
+    Vec<Vec<TokenId>> nbest = Decode(&search, scores);
+    ASSERT_EQ(nbest.size(), 1);
+    EXPECT_EQ(nbest[0], Vec<TokenId>({2, 4, 4, 4, 3}));
+    search.Reset();
+}
+
+// A sequence of num_slots word classes over the whole synthetic vocab, as a flat graph & as main graph + class subgraph,
+// where tokens of a class lead to one of 10 branch states, so that max_active prunes among branches.
+TEST(BeamSearch, MultiGraphPruned) {
+    Tokenizer tokenizer;
+    LoadSyntheticTokenizer(1000, &tokenizer);
+    const int num_slots = 20;
+    const int num_branches = 10;
+    const FsmLabel nonterminal = 100000;
+    const Str eps = std::to_string(kFsmEpsilon);
+
+    auto fsm_text = [](int num_states, const Vec<Str>& arcs) {
+        Str text = std::to_string(num_states) + "," + std::to_string(arcs.size()) + ",0," + std::to_string(num_states - 1) + "\n";
+        for (const Str& arc : arcs) {
+            text += arc + "\n";
+        }
+        return text;
+    };
+    auto arc = [](int src, int dst, const Str& ilabel, const Str& olabel, f32 score) {
+        return absl::StrFormat("%d %d %s:%s/%f", src, dst, ilabel, olabel, score);
+    };
+
+    // flat: S_k -eps-> E_k -token-> B_k,j -eps-> S_k+1, mirroring subgraph entry & return
+    Vec<Str> flat_arcs;
+    int stride = num_branches + 2;
+    for (int k = 0; k != num_slots; k++) {
+        int s = k * stride, e = s + 1;
+        flat_arcs.push_back(arc(s, e, eps, eps, 0.0));
+        for (TokenId t = 4; t != tokenizer.Size(); t++) {
+            int j = t % num_branches;
+            flat_arcs.push_back(arc(e, e + 1 + j, std::to_string(t), std::to_string(t), -0.1 * j));
+        }
+        for (int j = 0; j != num_branches; j++) {
+            flat_arcs.push_back(arc(e + 1 + j, s + stride, eps, eps, 0.0));
+        }
+    }
+    int last = num_slots * stride;
+    flat_arcs.push_back(arc(last, last + 1, "-1", std::to_string(tokenizer.eos), 0.0));
+    Fsm flat;
+    BuildFsm(fsm_text(last + 2, flat_arcs).c_str(), &flat);
+
+    Vec<Str> main_arcs;
+    for (int k = 0; k != num_slots; k++) {
+        main_arcs.push_back(arc(k, k + 1, eps, std::to_string(nonterminal), 0.0));
+    }
+    main_arcs.push_back(arc(num_slots, num_slots + 1, "-1", std::to_string(tokenizer.eos), 0.0));
+    Fsm main;
+    BuildFsm(fsm_text(num_slots + 2, main_arcs).c_str(), &main);
+
+    Vec<Str> class_arcs;
+    for (TokenId t = 4; t != tokenizer.Size(); t++) {
+        int j = t % num_branches;
+        class_arcs.push_back(arc(0, 1 + j, std::to_string(t), std::to_string(t), -0.1 * j));
+    }
+    for (int j = 0; j != num_branches; j++) {
+        class_arcs.push_back(arc(1 + j, num_branches + 1, "-1", std::to_string(tokenizer.eos), 0.0));
+    }
+    Fsm word_class;
+    BuildFsm(fsm_text(num_branches + 2, class_arcs).c_str(), &word_class);
+
+    Vec<Vec<f32>> scores = SyntheticPosteriors(tokenizer, num_slots, 0.0, 1234);
+
+    BeamSearchConfig config;
+    config.beam = 10.0;
+    config.max_active = 5; // > 3 tied best TokenSets of a frame, whose handles sort differently in two graphs
+    config.token_set_size = 2;
+    config.nbest = 4;
+
+    BeamSearch<> flat_search;
+    flat_search.Load(config, flat, tokenizer);
+    Vec<Vec<TokenId>> flat_nbest = Decode(&flat_search, scores);
+    EXPECT_GT(flat_nbest.size(), 1);
+    EXPECT_EQ(flat_search.Stats().active_token_sets.Max(), config.max_active);
+
+    BeamSearch<> search;
+    search.Load(config, main, tokenizer);
+    search.SetSubgraph(nonterminal, word_class);
+    EXPECT_EQ(Decode(&search, scores), flat_nbest);
+    EXPECT_EQ(search.Stats().num_tokens_created, flat_search.Stats().num_tokens_created);
+
+    flat_search.Reset();
+    search.Reset();
+}
+
+
+TEST(BeamSearch, TrailingBlankFrames) {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/tokenizer.vocab");
+
+    Fsm graph;
+    graph.BuildTokenTopology(tokenizer);
+
+    BeamSearchConfig config;
+    config.token_gc_interval = 4;
+
+    BeamSearch<> search;
+    search.Load(config, graph, tokenizer);
+
+    // blank * 3, a * 2, blank * 10
+    Vec<Vec<f32>> scores(15, Vec<f32>(tokenizer.Size(), log(0.01)));
+    for (int k = 0; k != scores.size(); k++) {
+        scores[k][(k >= 3 && k < 5) ? 4 : tokenizer.blk] = log(0.9);
+    }
+
+    bool decoded_anything = true;
+    EXPECT_EQ(search.TrailingBlankFrames(&decoded_anything), 0);
+    EXPECT_FALSE(decoded_anything);
+
+    for (int k = 0; k != scores.size(); k++) {
+        search.Push(torch::from_blob(scores[k].data(), {static_cast<long>(scores[k].size())}, torch::kFloat));
+        EXPECT_EQ(search.NumFrames(), k + 1);
+
+        int n = search.TrailingBlankFrames(&decoded_anything);
+        if (k < 3) {
+            EXPECT_EQ(n, k + 1);
+            EXPECT_FALSE(decoded_anything);
+        } else if (k < 5) {
+            EXPECT_EQ(n, 0);
+            EXPECT_TRUE(decoded_anything);
+        } else {
+            EXPECT_EQ(n, k - 4);
+            EXPECT_TRUE(decoded_anything);
+        }
+    }
+
+    search.PushEos();
+    EXPECT_EQ(search.NBest()[0], Vec<TokenId>({tokenizer.bos, 4, tokenizer.eos}));
+    search.Reset();
+}
+
+TEST(BeamSearch, Stats) {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/tokenizer.vocab");
+
+    Fsm graph;
+    graph.BuildTokenTopology(tokenizer);
+
+    Vec<Vec<f32>> scores = SyntheticScores(tokenizer, 200);
+
+    BeamSearchConfig config;
+    config.max_active = 3;
+    config.token_set_size = 2;
+
+    BeamSearch<> search;
+    search.Load(config, graph, tokenizer);
+
+    SearchStats total;
+    for (int n = 0; n != 2; n++) {
+        Decode(&search, scores);
+
+        const SearchStats& stats = search.Stats();
+        EXPECT_EQ(stats.num_sessions, 1);
+        EXPECT_EQ(stats.num_frames, scores.size());
+        EXPECT_GE(stats.num_arcs_visited, stats.num_tokens_created);
+        EXPECT_GT(stats.num_tokens_created, scores.size());
+        EXPECT_GT(stats.num_tokens_recombined, 0);
+        EXPECT_GT(stats.num_lm_calls, 0);
+
+        EXPECT_EQ(stats.active_token_sets.Count(), scores.size());
+        EXPECT_LE(stats.active_token_sets.Max(), config.max_active);
+        EXPECT_LE(stats.effective_beam.Max(), config.beam);
+        EXPECT_GE(stats.retained_slabs.Min(), 1);
+        EXPECT_EQ(stats.expand_ms.Count(), scores.size());
+        EXPECT_EQ(stats.prune_ms.Count(), scores.size());
+        EXPECT_EQ(stats.traceback_ms.Count(), 1);
+
+        total.Merge(stats);
+        search.Reset();
+    }
+
+    EXPECT_EQ(total.num_sessions, 2);
+    EXPECT_EQ(total.num_frames, 2 * scores.size());
+    EXPECT_EQ(total.active_token_sets.Count(), 2 * scores.size());
+    EXPECT_EQ(total.traceback_ms.Count(), 2);
+    EXPECT_EQ(total.num_tokens_created, 2 * search.Stats().num_tokens_created); // deterministic search
+    EXPECT_FALSE(total.Report().empty());
+}
+
+TEST(BeamSearch, ParallelExpansion) {
+    Tokenizer tokenizer;
+    LoadSyntheticTokenizer(1000, &tokenizer);
+
+    Fsm graph;
+    graph.BuildTokenTopology(tokenizer);
+
+    Vec<Vec<f32>> scores = SyntheticPosteriors(tokenizer, 200, 0.3, 1234);
+
+    BeamSearchConfig config;
+    config.beam = 6.0;  // binding during expansion, so beam updates are replayed exactly
+    config.max_active = 256;
+    config.token_set_size = 4;
+    config.nbest = 4;
+    config.insertion_penalty = 0.5;
+
+    for (f32 lattice_beam : {0.0, 8.0}) {
+        config.lattice_beam = lattice_beam;
+        config.num_expansion_threads = 1;
+        BeamSearch<> search;
+        search.Load(config, graph, tokenizer);
+        Vec<Vec<TokenId>> nbest = Decode(&search, scores);
+        EXPECT_EQ(nbest.size(), config.nbest);
+
+        config.num_expansion_threads = 3;
+        config.expansion_shard_size = 4;
+        BeamSearch<> parallel_search;
+        parallel_search.Load(config, graph, tokenizer);
+        for (int n = 0; n != 2; n++) {
+            EXPECT_EQ(Decode(&parallel_search, scores), nbest);
+
+            const SearchStats& x = search.Stats();
+            const SearchStats& y = parallel_search.Stats();
+            EXPECT_EQ(x.num_parallel_frames, 0);
+            EXPECT_GT(y.num_parallel_frames, scores.size() / 2);
+            EXPECT_EQ(x.num_arcs_visited, y.num_arcs_visited);
+            EXPECT_EQ(x.num_tokens_created, y.num_tokens_created);
+            EXPECT_EQ(x.num_tokens_recombined, y.num_tokens_recombined);
+            EXPECT_EQ(x.num_lm_calls, y.num_lm_calls);
+            EXPECT_EQ(x.num_lattice_arcs, y.num_lattice_arcs);
+            EXPECT_EQ(x.active_token_sets.Sum(), y.active_token_sets.Sum());
+
+            parallel_search.Reset();
+        }
+        search.Reset();
+    }
+}
+
+
+TEST(BeamSearch, AddLm) {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/tokenizer.vocab");
+
+    Fsm graph;
+    graph.BuildTokenTopology(tokenizer);
+
+    Vec<Vec<f32>> scores = SyntheticScores(tokenizer, 100);
+
+    BeamSearchConfig config;
+    config.max_active = 8;
+    config.token_set_size = 2;
+
+    BeamSearch<1> search;
+    search.Load(config, graph, tokenizer);
+    Vec<Vec<TokenId>> nbest = Decode(&search, scores);
+
+    // a 2nd prefix tree LM scores 0.0 & shares contexts with the built-in one
+    BeamSearch<2> two_lm_search;
+    two_lm_search.Load(config, graph, tokenizer);
+    two_lm_search.AddLm(std::make_unique<PrefixTreeLm>());
+    EXPECT_EQ(Decode(&two_lm_search, scores), nbest);
+    EXPECT_EQ(two_lm_search.Stats().num_lm_calls, 2 * search.Stats().num_lm_calls);
+}
+
+
+TEST(BeamSearch, AdaptiveBeam) {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/model/tokenizer.vocab"); // large vocab, so that noise blows up active set
+
+    Fsm graph;
+    graph.BuildTokenTopology(tokenizer);
+
+    // noisy audio: flat posteriors, no dominating blank
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<f32> uniform(-3.0, 0.0);
+    Vec<Vec<f32>> scores(50, Vec<f32>(tokenizer.Size()));
+    for (auto& frame : scores) {
+        for (auto& x : frame) x = uniform(rng);
+    }
+
+    BeamSearchConfig config;
+    config.beam = 16.0;
+    config.max_active = 100000;
+
+    BeamSearch<> fixed_search;
+    fixed_search.Load(config, graph, tokenizer);
+    Decode(&fixed_search, scores);
+    EXPECT_EQ(fixed_search.Beam(), config.beam);
+
+    config.adaptive_target_active = 32;
+    config.adaptive_min_beam = 0.1;
+    BeamSearch<> adaptive_search;
+    adaptive_search.Load(config, graph, tokenizer);
+    Decode(&adaptive_search, scores);
+    EXPECT_LT(adaptive_search.Stats().active_token_sets.Mean(), fixed_search.Stats().active_token_sets.Mean() / 4);
+    EXPECT_GE(adaptive_search.Beam(), config.adaptive_min_beam);
+    EXPECT_LT(adaptive_search.Beam(), config.beam);
+
+    // every frame is over a tiny budget, so beam collapses to its lower bound
+    config.adaptive_frame_budget_ms = 1e-6;
+    BeamSearch<> budget_search;
+    budget_search.Load(config, graph, tokenizer);
+    Decode(&budget_search, scores);
+    EXPECT_EQ(budget_search.Beam(), config.adaptive_min_beam);
+}
+
+
+TEST(BeamSearch, LatticeNBest) {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/tokenizer.vocab");
+
+    Fsm graph;
+    graph.BuildTokenTopology(tokenizer);
+
+    Vec<Vec<f32>> scores = SyntheticScores(tokenizer, 30);
+
+    BeamSearchConfig config;
+    config.beam = 16.0;
+    config.max_active = 1000;
+    config.nbest = 5;
+
+    // reference: wide token sets, each token is a distinct label history under prefix tree LM
+    config.token_set_size = 100;
+    BeamSearch<> wide_search;
+    wide_search.Load(config, graph, tokenizer);
+    Vec<Vec<TokenId>> reference = Decode(&wide_search, scores);
+    ASSERT_EQ(reference.size(), config.nbest);
+
+    config.token_set_size = 1;
+    BeamSearch<> narrow_search;
+    narrow_search.Load(config, graph, tokenizer);
+    Vec<Vec<TokenId>> narrow = Decode(&narrow_search, scores);
+    EXPECT_EQ(narrow.size(), 1);
+
+    config.lattice_beam = 100.0;
+    BeamSearch<> lattice_search;
+    lattice_search.Load(config, graph, tokenizer);
+    for (int n = 0; n != 2; n++) {  // 2nd session reuses lattice arcs
+        EXPECT_EQ(Decode(&lattice_search, scores), reference);
+        EXPECT_GT(lattice_search.Stats().num_lattice_arcs, 0);
+        lattice_search.Reset();
+    }
+
+    // GC keeps tokens reachable via alternative arcs only
+    config.token_gc_interval = 3;
+    BeamSearch<> gc_search;
+    gc_search.Load(config, graph, tokenizer);
+    EXPECT_EQ(Decode(&gc_search, scores), reference);
+    EXPECT_GT(gc_search.Stats().num_gc_reclaimed_tokens, 0);
+}
+
+
+// Same as above on a realistic vocab, with beam & max_active pruning on both sides of the comparison
+TEST(BeamSearch, LatticeNBestPruned) {
+    Tokenizer tokenizer;
+    LoadSyntheticTokenizer(1000, &tokenizer);
+
+    Fsm graph;
+    graph.BuildTokenTopology(tokenizer);
+
+    Vec<Vec<f32>> scores = SyntheticPosteriors(tokenizer, 100, 0.3, 4321);
+
+    BeamSearchConfig config;
+    config.beam = 10.0;
+    config.max_active = 16;
+    config.nbest = 5;
+
+    config.token_set_size = 100;
+    BeamSearch<> wide_search;
+    wide_search.Load(config, graph, tokenizer);
+    Vec<Vec<TokenId>> reference = Decode(&wide_search, scores);
+    ASSERT_EQ(reference.size(), config.nbest);
+    EXPECT_EQ(wide_search.Stats().active_token_sets.Max(), config.max_active);
+
+    config.token_set_size = 1;
+    config.lattice_beam = 100.0;
+    config.token_gc_interval = 3;
+    BeamSearch<> lattice_search;
+    lattice_search.Load(config, graph, tokenizer);
+    EXPECT_EQ(Decode(&lattice_search, scores), reference);
+    EXPECT_GT(lattice_search.Stats().num_lattice_arcs, 0);
+    EXPECT_GT(lattice_search.Stats().num_gc_reclaimed_tokens, 0);
+}
+
+
+TEST(BeamSearch, SnapshotRestore) {
+    Tokenizer tokenizer;
+    tokenizer.Load("testdata/tokenizer.vocab");
+
+    Fsm graph;
+    graph.BuildTokenTopology(tokenizer);
+
+    Vec<Vec<f32>> scores = SyntheticScores(tokenizer, 60);
+    Vec<Vec<f32>> first_half(scores.begin(), scores.begin() + 30);
+    Vec<Vec<f32>> second_half(scores.begin() + 30, scores.end());
+
+    BeamSearchConfig config;
+    config.beam = 16.0;
+    config.max_active = 100;
+    config.token_set_size = 2;
+    config.nbest = 5;
+    config.lattice_beam = 100.0;
+    config.token_gc_interval = 7;
+
+    BeamSearch<> reference_search;
+    reference_search.Load(config, graph, tokenizer);
+    Vec<Vec<TokenId>> reference = Decode(&reference_search, scores);
+
+    // hand over in the middle of a session
+    BeamSearch<> src;
+    src.Load(config, graph, tokenizer);
+    for (auto& frame : first_half) {
+        src.Push(torch::from_blob(frame.data(), {static_cast<long>(frame.size())}, torch::kFloat));
+    }
+    Str bytes;
+    SnapshotWriter w(&bytes);
+    ASSERT_EQ(src.Snapshot(&w), Error::OK);
+    src.Reset();  // unfinished session is discarded
+
+    BeamSearch<> dst;
+    dst.Load(config, graph, tokenizer);
+    SnapshotReader r(bytes.data(), bytes.size());
+    ASSERT_EQ(dst.Restore(&r), Error::OK);
+    EXPECT_TRUE(r.Done());
+    EXPECT_EQ(dst.NumFrames(), first_half.size());
+    EXPECT_EQ(Decode(&dst, second_half), reference);
+
+    // truncated snapshot is rejected, the search stays idle & reusable
+    dst.Reset();
+    SnapshotReader truncated(bytes.data(), bytes.size() / 2);
+    EXPECT_EQ(dst.Restore(&truncated), Error::InvalidSnapshot);
+    EXPECT_EQ(dst.NumLiveTokens(), 0);
+    EXPECT_EQ(Decode(&dst, scores), reference);
+
+    // so is a snapshot of a search with different number of LMs
+    BeamSearch<2> two_lm_search;
+    two_lm_search.Load(config, graph, tokenizer);
+    two_lm_search.AddLm(std::make_unique<PrefixTreeLm>());
+    SnapshotReader mismatched(bytes.data(), bytes.size());
+    EXPECT_EQ(two_lm_search.Restore(&mismatched), Error::InvalidSnapshot);
+}
+
+
+// Every 4-byte word of a snapshot is overwritten with out-of-range or aliasing values, e.g. token, arc & graph indexes:
+// restore either rejects it, or the session goes on safely (checked by sanitizers).
+// Corrupts i32 fields of packed tokens & token sets, restored search either rejects the snapshot or runs to the end.
+// Not in lattice mode, where N-best extraction is bounded by lattice_nbest_max_pops & would hide cyclic token chains.
+TEST(BeamSearch, SnapshotCorruption) {
+    Tokenizer tokenizer;
+    LoadSyntheticTokenizer(100, &tokenizer);
+
+    Fsm graph;
+    graph.BuildTokenTopology(tokenizer);
+
+    Vec<Vec<f32>> scores = SyntheticPosteriors(tokenizer, 20, 0.3, 1234);
+
+    BeamSearchConfig config;
+    config.max_active = 8;
+    config.token_set_size = 2;
+
+    BeamSearch<> src;
+    src.Load(config, graph, tokenizer);
+    for (auto& frame : scores) {
+        src.Push(frame.data());
+    }
+    Str bytes;
+    SnapshotWriter w(&bytes);
+    ASSERT_EQ(src.Snapshot(&w), Error::OK);
+
+    // field offsets, see BeamSearch::Snapshot()
+    auto get_u64 = [&](size_t offset) { u64 n; memcpy(&n, &bytes[offset], sizeof(n)); return n; };
+    size_t offset = 4 + 3 * sizeof(i32) + 2 * sizeof(i64) + sizeof(u8) + sizeof(i32) + 4 * sizeof(f32);
+    offset += sizeof(u64) + get_u64(offset) * sizeof(GraphInstance);
+    const i32 num_tokens = get_u64(offset);
+    const size_t tokens_begin = offset + sizeof(u64);
+    offset = tokens_begin + num_tokens * sizeof(PackedToken<1>);
+    const i32 num_token_sets = get_u64(offset);
+    const size_t token_sets_begin = offset + sizeof(u64);
+    ASSERT_GT(num_tokens, 2);
+    ASSERT_GT(num_token_sets, 0);
+
+    auto trace_back_of = [&](i32 k) { return tokens_begin + k * sizeof(PackedToken<1>) + offsetof(PackedToken<1>, trace_back); };
+    auto get_i32 = [&](size_t offset) { i32 x; memcpy(&x, &bytes[offset], sizeof(x)); return x; };
+    ASSERT_EQ(get_i32(trace_back_of(num_tokens - 1)), -1); // initial token is written last
+
+    BeamSearch<> dst;
+    dst.Load(config, graph, tokenizer);
+    auto restore = [&](size_t offset, i32 v, bool decode) {
+        Str corrupted = bytes;
+        memcpy(&corrupted[offset], &v, sizeof(v));
+        SnapshotReader r(corrupted.data(), corrupted.size());
+        Error err = dst.Restore(&r);
+        if (err == Error::OK && decode) {
+            for (auto& frame : scores) {
+                dst.Push(frame.data());
+            }
+            dst.PushEos();
+            dst.NBest();
+        }
+        if (err == Error::OK) {
+            dst.Reset();
+        }
+        return err;
+    };
+
+    EXPECT_EQ(restore(trace_back_of(num_tokens - 1), -1, true), Error::OK); // intact
+
+    // self loops & backward trace backs, i.e. cyclic token chains, not decoded as they would never end
+    for (i32 k = 0; k != num_tokens; k++) {
+        EXPECT_EQ(restore(trace_back_of(k), k, false), Error::InvalidSnapshot);
+        if (k > 0) {
+            EXPECT_EQ(restore(trace_back_of(k), k - 1, false), Error::InvalidSnapshot);
+        }
+    }
+
+    int num_rejected = 0;
+    auto corrupt_fields = [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k += sizeof(i32)) {
+            for (i32 v : {-2, -1, 0, 1, num_tokens - 1, num_tokens, 1 << 30}) {
+                num_rejected += (restore(k, v, true) != Error::OK);  // search stays idle if rejected
+            }
+        }
+    };
+    corrupt_fields(tokens_begin, tokens_begin + num_tokens * sizeof(PackedToken<1>));
+    corrupt_fields(token_sets_begin, token_sets_begin + num_token_sets * sizeof(PackedTokenSet));
+    EXPECT_GT(num_rejected, 0);
+
+}
+
+} // namespace sio
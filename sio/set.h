@@ -0,0 +1,27 @@
+#ifndef SIO_SET_H
+#define SIO_SET_H
+
+#include <unordered_set>
+#include <absl/container/flat_hash_set.h>
+
+namespace sio {
+
+template <
+    class K,
+    class Hash = std::hash<K>,
+    class Eq = std::equal_to<K>,
+    class Allocator = std::allocator<K>
+>
+using Set = std::unordered_set<K, Hash, Eq, Allocator>;
+
+template <
+    class K,
+    class Hash = absl::container_internal::hash_default_hash<K>,
+    class Eq = absl::container_internal::hash_default_eq<K>,
+    class Allocator = std::allocator<K>
+>
+using FastSet = absl::flat_hash_set<K, Hash, Eq, Allocator>;
+
+};
+
+#endif
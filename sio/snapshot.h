@@ -0,0 +1,146 @@
+#ifndef SIO_SNAPSHOT_H
+#define SIO_SNAPSHOT_H
+
+#include <string.h>
+#include <type_traits>
+
+#include "sio/base.h"
+
+namespace sio {
+
+/*
+ * Flat binary encoding of session states, for handing a live session over to another process.
+ *   1. values are raw bytes in host byte order, both sides are expected to run the same build & models.
+ *   2. no pointers: objects referring to each other are encoded by indexes.
+ *   3. each component writes a tag first, so a mismatched layout is detected at restore.
+ */
+class SnapshotWriter {
+    Str* buf_ = nullptr;
+
+public:
+
+    explicit SnapshotWriter(Str* buf) : buf_(buf) { }
+
+
+    void PutBytes(const void* data, size_t size) {
+        if (size == 0) {
+            return; // data of an empty Vec may be nullptr
+        }
+        buf_->append(static_cast<const char*>(data), size);
+    }
+
+
+    template <typename T>
+    void Put(const T& x) {
+        static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable values are put as raw bytes");
+        PutBytes(&x, sizeof(T));
+    }
+
+
+    template <typename T>
+    void PutVec(const T* data, size_t n) {
+        static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable values are put as raw bytes");
+        Put<u64>(n);
+        PutBytes(data, n * sizeof(T));
+    }
+
+
+    template <typename T>
+    void PutVec(const Vec<T>& v) {
+        PutVec(v.data(), v.size());
+    }
+
+
+    void PutStr(const Str& s) {
+        PutVec(s.data(), s.size());
+    }
+
+
+    // 4-char component tag, e.g. "SRCH"
+    void PutTag(const char* tag) {
+        PutBytes(tag, 4);
+    }
+
+}; // class SnapshotWriter
+
+
+class SnapshotReader {
+    const char* cur_ = nullptr;
+    const char* end_ = nullptr;
+
+public:
+
+    SnapshotReader(const char* data, size_t size) : cur_(data), end_(data + size) { }
+
+
+    Error GetBytes(void* data, size_t size) {
+        if (end_ - cur_ < size) {
+            SIO_ERROR << "Truncated snapshot, " << size << " bytes expected, " << (end_ - cur_) << " left.";
+            return Error::InvalidSnapshot;
+        }
+        if (size == 0) {
+            return Error::OK; // data of an empty Vec may be nullptr, which memcpy doesn't take even for 0 bytes
+        }
+        memcpy(data, cur_, size);
+        cur_ += size;
+        return Error::OK;
+    }
+
+
+    template <typename T>
+    Error Get(T* x) {
+        static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable values are got as raw bytes");
+        return GetBytes(x, sizeof(T));
+    }
+
+
+    template <typename T>
+    Error GetVec(Vec<T>* v) {
+        static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable values are got as raw bytes");
+        u64 n = 0;
+        if (Get(&n) != Error::OK || (end_ - cur_) / sizeof(T) < n) {
+            return Error::InvalidSnapshot;
+        }
+        v->resize(n);
+        return GetBytes(v->data(), n * sizeof(T));
+    }
+
+
+    Error GetStr(Str* s) {
+        u64 n = 0;
+        if (Get(&n) != Error::OK || end_ - cur_ < n) {
+            return Error::InvalidSnapshot;
+        }
+        s->assign(cur_, n);
+        cur_ += n;
+        return Error::OK;
+    }
+
+
+    Error ExpectTag(const char* tag) {
+        char x[4];
+        if (GetBytes(x, 4) != Error::OK || memcmp(x, tag, 4) != 0) {
+            SIO_ERROR << "Snapshot tag mismatch, expecting: " << Str(tag, 4);
+            return Error::InvalidSnapshot;
+        }
+        return Error::OK;
+    }
+
+
+    bool Done() const {
+        return cur_ == end_;
+    }
+
+}; // class SnapshotReader
+
+
+// Early return on snapshot decoding errors
+#define SIO_SNAPSHOT_GET(expr) do {        \
+    ::sio::Error _err = (expr);            \
+    if (_err != ::sio::Error::OK) {        \
+        return _err;                       \
+    }                                      \
+} while(0)
+
+} // namespace sio
+#endif
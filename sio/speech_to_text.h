@@ -2,6 +2,10 @@
 #define SIO_SPEECH_TO_TEXT_H
 
 #include <stddef.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include <torch/torch.h>
 #include <torch/script.h>
@@ -11,16 +15,90 @@
 #include "sio/tokenizer.h"
 #include "sio/scorer.h"
 #include "sio/search.h"
+#include "sio/endpoint.h"
+#include "sio/snapshot.h"
+#include "sio/latency_stats.h"
+#include "sio/spsc_queue.h"
 #include "sio/speech_to_text_model.h"
 
 namespace sio {
+/*
+ * SpeechToText runs a session through 3 stages: feature extraction -> scorer -> search.
+ *   sync mode: stages run one after another on caller's thread, within Speech() & To().
+ *   async mode: each stage runs on its own thread, joined by bounded SPSC queues,
+ *     so search consumes chunk N while scorer computes chunk N+1,
+ *     and Speech() returns once audio is queued, blocking only when queues are full.
+ *     To() waits until all queued audio has gone through, after which Text(), Stats() etc. are read as in sync mode,
+ *     PartialText() is a copy published by search stage, so it can be read any time.
+ * In both modes, a session is driven from one caller thread.
+ * Each stage times itself into stats owned by that stage, which Latency() gathers per session.
+ */
 class SpeechToText {
+    // pipeline messages, signal applies after data of the same message
+    enum class Signal { kNone, kEos, kSync, kStop };
+    struct AudioChunk {
+        Vec<f32> samples;
+        f32 sample_rate = 0.0;
+        Signal signal = Signal::kNone;
+    };
+    struct FeatureChunk {
+        Vec<f32> feats;  // [frames, dim] row-major
+        Signal signal = Signal::kNone;
+    };
+    struct ScoreChunk {
+        Vec<torch::Tensor> scores;
+        Signal signal = Signal::kNone;
+    };
+
     const Tokenizer* tokenizer_ = nullptr;
     FeatureExtractor feature_extractor_;
     Scorer scorer_;
-    BeamSearch beam_search_;
+    BeamSearch<> beam_search_;
+
+    bool do_endpointing_ = false;
+    EndpointConfig endpoint_config_;
+    f32 frame_duration_ = 0.0;  // seconds per search frame
+    std::atomic<bool> endpointed_{false};  // result is finalized, further speech is ignored until Reset()
+
+    // latency of current session, see Latency():
+    //   feature_ms & audio_seconds are written by feature stage, first_partial_ms by search stage, others by caller
+    LatencyStats latency_;
+    std::chrono::steady_clock::time_point session_begin_;  // first Speech() of session
+    bool session_begun_ = false;
+    bool first_partial_seen_ = false;  // search stage only
+
+    // sync mode stage outputs, reused across calls,
+    // features are written straight into scorer's buffer, see FeatureStage()
+    Vec<torch::Tensor> scores_;
+
+    // async mode
+    bool async_ = false;
+    Unique<SpscQueue<AudioChunk>*> audio_queue_;
+    Unique<SpscQueue<FeatureChunk>*> feature_queue_;
+    Unique<SpscQueue<ScoreChunk>*> score_queue_;
+    Vec<std::thread> stages_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    i64 num_barriers_sent_ = 0;  // eos & sync signals sent by caller
+    i64 num_barriers_done_ = 0;  // eos & sync signals reached the end of search stage, guarded by mutex_
+    Str partial_stable_, partial_unstable_;  // guarded by mutex_
 
 public:
+
+    ~SpeechToText() {
+        if (!async_) {
+            return;
+        }
+        AudioChunk stop;
+        stop.signal = Signal::kStop;
+        audio_queue_->Push(std::move(stop));
+        for (std::thread& t : stages_) {
+            t.join();
+        }
+    }
+
+
     Error Load(SpeechToTextModel& model) {
         SIO_CHECK(tokenizer_ == nullptr); // Can't reload
         tokenizer_ = &model.tokenizer;
@@ -36,7 +114,8 @@ public:
             model.config.scorer,
             model.nnet,
             feature_extractor_.Dim(),
-            tokenizer_->Size()
+            tokenizer_->Size(),
+            model.batch_scorer.get()
         );
 
         SIO_INFO << "Loading beam search ...";
@@ -46,18 +125,57 @@ public:
             model.tokenizer
         );
 
+        do_endpointing_ = model.config.do_endpointing;
+        endpoint_config_ = model.config.endpoint;
+        frame_duration_ = scorer_.SubsamplingFactor() / feature_extractor_.FrameRate();
+
+        if (model.config.async) {
+            SIO_INFO << "Starting async pipeline ...";
+            StartPipeline(model.config.async_queue_size);
+        }
+
         return Error::OK;
     }
 
 
     Error Speech(const f32* samples, size_t num_samples, f32 sample_rate) {
         SIO_CHECK(samples != nullptr && num_samples != 0);
-        return Advance(samples, num_samples, sample_rate, /*eos*/false);
+        if (!session_begun_) {
+            session_begun_ = true;
+            session_begin_ = std::chrono::steady_clock::now();
+        }
+        if (!async_) {
+            return Advance(samples, num_samples, sample_rate, /*eos*/false);
+        }
+
+        if (endpointed_) {
+            return Error::OK;
+        }
+        AudioChunk c;
+        c.samples.assign(samples, samples + num_samples);
+        c.sample_rate = sample_rate;
+        audio_queue_->Push(std::move(c));
+        return Error::OK;
     }
 
 
     Error To() { 
-        return Advance(nullptr, 0, /*dont care sample rate*/123.456, /*eos*/true);
+        bool endpointed = endpointed_;  // result is already final otherwise
+        auto eos_begin = std::chrono::steady_clock::now();
+        if (!async_) {
+            Advance(nullptr, 0, /*dont care sample rate*/123.456, /*eos*/true);
+        } else {
+            WaitPipeline(Signal::kEos);
+        }
+
+        if (!endpointed) {
+            latency_.eos_to_final_ms.Add(ElapsedMs(eos_begin));
+        }
+        latency_.num_sessions = 1;
+        if (latency_.audio_seconds > 0.0) {
+            latency_.rtf.Add(ComputeSeconds() / latency_.audio_seconds);
+        }
+        return Error::OK;
     }
 
 
@@ -73,10 +191,107 @@ public:
     }
 
 
+    // Partial text of current best path during streaming,
+    // *stable part is shared by all surviving hypotheses so it won't change anymore.
+    Error PartialText(std::string* stable, std::string* unstable) {
+        if (async_) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            *stable += partial_stable_;
+            *unstable += partial_unstable_;
+            return Error::OK;
+        }
+
+        const Vec<TokenId>& path = beam_search_.PartialResult();
+        size_t num_stable = beam_search_.NumStableTokens();
+        for (size_t i = 0; i != path.size(); i++) {
+            *(i < num_stable ? stable : unstable) += tokenizer_->Token(path[i]);
+        }
+
+        return Error::OK;
+    }
+
+
+    // Search statistics of current(or latest) utterance, see SearchStats::Merge() for aggregation,
+    // in async mode, valid after To()
+    const SearchStats& Stats() const {
+        return beam_search_.Stats();
+    }
+
+
+    // Per-stage latency of current(or latest) utterance, see LatencyStats::Merge() for aggregation,
+    // in async mode, valid after To()
+    LatencyStats Latency() const {
+        LatencyStats s = latency_;
+        s.compute_seconds = ComputeSeconds();
+        s.encoder_forward_ms = scorer_.Stats().encoder_forward_ms;
+        s.ctc_activation_ms = scorer_.Stats().ctc_activation_ms;
+        s.search_expand_ms = beam_search_.Stats().expand_ms;
+        s.search_prune_ms = beam_search_.Stats().prune_ms;
+        s.traceback_ms = beam_search_.Stats().traceback_ms;
+        return s;
+    }
+
+
+    // Whether an endpoint is detected, after which result is final and further speech is ignored,
+    // so callers may stop sending audio and call Text() & Reset() right away.
+    bool Endpointed() const {
+        return endpointed_;
+    }
+
+
+    // Session handover, e.g. for rebalancing long streams across worker processes:
+    //   *bytes is a compact binary snapshot of current session, taken between Speech() calls,
+    //   restored into another SpeechToText loaded with the same model, which then continues this session.
+    // The original session can be discarded via Reset() afterwards.
+    Error Snapshot(Str* bytes) {
+        if (async_) {
+            WaitPipeline(Signal::kSync); // queued audio goes through first, so stages are idle
+        }
+        bytes->clear();
+        SnapshotWriter w(bytes);
+        w.PutTag("SIO1");  // format version
+        SIO_SNAPSHOT_GET(feature_extractor_.Snapshot(&w));
+        SIO_SNAPSHOT_GET(scorer_.Snapshot(&w));
+        SIO_SNAPSHOT_GET(beam_search_.Snapshot(&w));
+        w.Put<u8>(endpointed_.load());
+        return Error::OK;
+    }
+
+
+    // Should be called on a new or reset SpeechToText
+    Error Restore(const Str& bytes) {
+        SnapshotReader r(bytes.data(), bytes.size());
+        u8 endpointed = 0;
+        SIO_SNAPSHOT_GET(r.ExpectTag("SIO1"));
+        SIO_SNAPSHOT_GET(feature_extractor_.Restore(&r));
+        SIO_SNAPSHOT_GET(scorer_.Restore(&r));
+        SIO_SNAPSHOT_GET(beam_search_.Restore(&r));
+        SIO_SNAPSHOT_GET(r.Get(&endpointed));
+        if (!r.Done()) {
+            return Error::InvalidSnapshot;
+        }
+        endpointed_ = endpointed;
+        return Error::OK;
+    }
+
+
     Error Reset() { 
+        if (async_) {
+            WaitPipeline(Signal::kSync); // stages are idle until next Speech()
+            std::lock_guard<std::mutex> lock(mutex_);
+            partial_stable_.clear();
+            partial_unstable_.clear();
+        }
+
         feature_extractor_.Reset();
         scorer_.Reset();
+        scorer_.ResetStats();  // scorer stats accumulate across sessions on their own
         beam_search_.Reset();
+        endpointed_ = false;
+
+        latency_.Reset();
+        session_begun_ = false;
+        first_partial_seen_ = false;
 
         return Error::OK; 
     }
@@ -84,30 +299,201 @@ public:
 private:
 
     Error Advance(const f32* samples, size_t num_samples, f32 sample_rate, bool eos) {
+        if (endpointed_) {
+            return Error::OK; // neither scorer nor search is fed after endpoint
+        }
+
+        scores_.clear();
+        FeatureStage(samples, num_samples, sample_rate, eos, nullptr);
+        ScorerStage(Vec<f32>(), eos, &scores_);
+        SearchStage(scores_, eos);
+
+        if (!first_partial_seen_ && !scores_.empty()) {
+            ObserveFirstPartial(beam_search_.PartialResult());
+        }
+
+        return Error::OK;
+    }
+
+
+    // Ready frames are popped into *feats in one block (async mode, handed over to scorer stage),
+    // or straight into scorer's feature buffer if feats is nullptr (sync mode), where scorer advances as chunks fill up.
+    void FeatureStage(const f32* samples, size_t num_samples, f32 sample_rate, bool eos, Vec<f32>* feats) {
+        auto begin = std::chrono::steady_clock::now();
         if (samples != nullptr && num_samples != 0) {
             feature_extractor_.Push(samples, num_samples, sample_rate);
+            latency_.audio_seconds += num_samples / sample_rate;
         }
         if (eos) {
             feature_extractor_.PushEos();
         }
 
+        size_t dim = scorer_.FeatDim();
+        if (feats != nullptr) {
+            feats->resize(feature_extractor_.Size() * dim);
+            feature_extractor_.PopBatch(feature_extractor_.Size(), feats->data(), dim);
+            latency_.feature_ms.Add(ElapsedMs(begin));
+            return;
+        }
+
+        f32 feature_ms = ElapsedMs(begin);
         while (feature_extractor_.Size() > 0) {
-            scorer_.Push(feature_extractor_.Pop());
+            auto pop_begin = std::chrono::steady_clock::now();
+            size_t n = 0;
+            f32* slots = scorer_.FeatSlots(feature_extractor_.Size(), &n);
+            feature_extractor_.PopBatch(n, slots, dim);
+            feature_ms += ElapsedMs(pop_begin);
+            scorer_.CommitFeats(n); // scorer's own time, see ScorerStats
+        }
+        latency_.feature_ms.Add(feature_ms);
+    }
+
+
+    // feats: [frames, dim] row-major from async feature stage, empty in sync mode
+    void ScorerStage(const Vec<f32>& feats, bool eos, Vec<torch::Tensor>* scores) {
+        if (!feats.empty()) {
+            scorer_.Push(feats.data(), feats.size() / scorer_.FeatDim());
         }
         if (eos) {
             scorer_.PushEos();
         }
 
         while (scorer_.Size() > 0) {
-            beam_search_.Push(scorer_.Pop());
+            scores->push_back(scorer_.Pop());
+        }
+    }
+
+
+    void SearchStage(const Vec<torch::Tensor>& scores, bool eos) {
+        if (endpointed_) {
+            return;
+        }
+
+        for (const torch::Tensor& score_frame : scores) {
+            beam_search_.Push(score_frame);
+
+            if (do_endpointing_ && !eos && DetectEndpoint()) {
+                beam_search_.PushEos();
+                endpointed_ = true;
+                return;
+            }
         }
         if (eos) {
             beam_search_.PushEos();
         }
+    }
+
+
+    // Search stage only, path: partial result after latest frames,
+    // which always starts with bos of the initial token, so only recognized tokens count
+    void ObserveFirstPartial(const Vec<TokenId>& path) {
+        if (HasRecognizedToken(path, *tokenizer_)) {
+            first_partial_seen_ = true;
+            latency_.first_partial_ms.Add(ElapsedMs(session_begin_));
+        }
+    }
+
+
+    // Sum of stage busy time, excluding time waiting in between
+    f64 ComputeSeconds() const {
+        f64 ms = latency_.feature_ms.Sum()
+            + scorer_.Stats().chunk_latency_ms.Sum()
+            + beam_search_.Stats().expand_ms.Sum()
+            + beam_search_.Stats().prune_ms.Sum()
+            + beam_search_.Stats().traceback_ms.Sum();
+        return ms / 1000.0;
+    }
+
+
+    void StartPipeline(int queue_size) {
+        async_ = true;
+        audio_queue_ = std::make_unique<SpscQueue<AudioChunk>>(queue_size);
+        feature_queue_ = std::make_unique<SpscQueue<FeatureChunk>>(queue_size);
+        score_queue_ = std::make_unique<SpscQueue<ScoreChunk>>(queue_size);
 
+        // after endpoint, data is dropped by each stage while signals are still passed down
+        stages_.emplace_back([this]() {
+            AudioChunk in;
+            do {
+                audio_queue_->Pop(&in);
+                FeatureChunk out;
+                out.signal = in.signal;
+                if (!endpointed_) {
+                    FeatureStage(in.samples.data(), in.samples.size(), in.sample_rate, in.signal == Signal::kEos, &out.feats);
+                }
+                feature_queue_->Push(std::move(out));
+            } while (in.signal != Signal::kStop);
+        });
+
+        stages_.emplace_back([this]() {
+            at::init_num_threads(); // nnet forward runs on this thread
+            FeatureChunk in;
+            do {
+                feature_queue_->Pop(&in);
+                ScoreChunk out;
+                out.signal = in.signal;
+                if (!endpointed_) {
+                    ScorerStage(in.feats, in.signal == Signal::kEos, &out.scores);
+                }
+                score_queue_->Push(std::move(out));
+            } while (in.signal != Signal::kStop);
+        });
+
+        stages_.emplace_back([this]() {
+            ScoreChunk in;
+            do {
+                score_queue_->Pop(&in);
+                SearchStage(in.scores, in.signal == Signal::kEos);
+
+                Str stable, unstable;
+                if (!in.scores.empty()) {
+                    const Vec<TokenId>& path = beam_search_.PartialResult();
+                    if (!first_partial_seen_) {
+                        ObserveFirstPartial(path);
+                    }
+                    size_t num_stable = beam_search_.NumStableTokens();
+                    for (size_t i = 0; i != path.size(); i++) {
+                        (i < num_stable ? stable : unstable) += tokenizer_->Token(path[i]);
+                    }
+                }
+
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!in.scores.empty()) {
+                    partial_stable_.swap(stable);
+                    partial_unstable_.swap(unstable);
+                }
+                if (in.signal == Signal::kEos || in.signal == Signal::kSync) {
+                    num_barriers_done_++;
+                    cond_.notify_all();
+                }
+            } while (in.signal != Signal::kStop);
+        });
+    }
+
+
+    // Sends a signal down the pipeline & waits until search stage is done with it
+    Error WaitPipeline(Signal signal) {
+        AudioChunk c;
+        c.signal = signal;
+        audio_queue_->Push(std::move(c));
+
+        i64 n = ++num_barriers_sent_;
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [&]() { return num_barriers_done_ >= n; });
         return Error::OK;
     }
 
+
+    bool DetectEndpoint() const {
+        bool decoded_anything = false;
+        int trailing_blank_frames = beam_search_.TrailingBlankFrames(&decoded_anything);
+        return sio::DetectEndpoint(endpoint_config_,
+            decoded_anything,
+            trailing_blank_frames * frame_duration_,
+            beam_search_.NumFrames() * frame_duration_
+        );
+    }
+
 }; // class SpeechToText
 }  // namespace sio
 #endif
@@ -7,11 +7,17 @@
 #include "sio/struct_loader.h"
 #include "sio/feature_extractor.h"
 #include "sio/scorer.h"
+#include "sio/endpoint.h"
 
 namespace sio {
 struct SpeechToTextConfig {
     bool online = true;
 
+    // async pipeline: feature extraction, scorer & search run on their own threads per session,
+    // joined by bounded queues of async_queue_size chunks, see SpeechToText
+    bool async = false;
+    int async_queue_size = 16;
+
     FeatureExtractorConfig feature_extractor;
     std::string mean_var_norm;
 
@@ -20,15 +26,19 @@ struct SpeechToTextConfig {
 
     std::string nnet;
     ScorerConfig scorer;
+    BatchScorerConfig batch_scorer;
 
     std::string graph;
     std::string context;
     bool do_endpointing = false;
+    EndpointConfig endpoint;
 
     BeamSearchConfig beam_search;
 
     Error Register(StructLoader* loader, const std::string module = "") {
         loader->AddEntry(module + ".online", &online);
+        loader->AddEntry(module + ".async", &async);
+        loader->AddEntry(module + ".async_queue_size", &async_queue_size);
 
         feature_extractor.Register(loader, module + ".feature_extractor");
         loader->AddEntry(module + ".mean_var_norm", &mean_var_norm);
@@ -38,10 +48,12 @@ struct SpeechToTextConfig {
 
         loader->AddEntry(module + ".nnet", &nnet);
         scorer.Register(loader, module + ".scorer");
+        batch_scorer.Register(loader, module + ".batch_scorer");
 
         loader->AddEntry(module + ".graph", &graph);
         loader->AddEntry(module + ".context", &context);
         loader->AddEntry(module + ".do_endpointing", &do_endpointing);
+        endpoint.Register(loader, module + ".endpoint");
 
         beam_search.Register(loader, module + ".beam_search");
 
@@ -2,20 +2,23 @@
 #define SIO_SPEECH_TO_TEXT_MODEL_H
 
 #include <fstream>
+#include <mutex>
 
 #include <torch/script.h>
 
 #include "sio/base.h"
 #include "sio/mean_var_norm.h"
 #include "sio/tokenizer.h"
+#include "sio/batch_scorer.h"
 #include "sio/finite_state_machine.h"
 #include "sio/speech_to_text_config.h"
 
 namespace sio {
 /*
  * SpeechToTextModel stores stateless resources, 
- * can be shared by different threads.
- * TODO: check torchscript multi-thread usage.
+ * can be shared by different threads:
+ *   resources are only read after Load(), e.g. nnet is switched to eval mode here,
+ *   so concurrent sessions only run its methods, which torchscript supports for a module not being modified.
  */
 struct SpeechToTextModel {
     SpeechToTextConfig config;
@@ -26,6 +29,8 @@ struct SpeechToTextModel {
 
     torch::jit::script::Module nnet;
 
+    Unique<BatchScorer*> batch_scorer; // shared by all sessions of this model, only if batching is enabled
+
     Fsm graph;
 
     Error Load(std::string config_file) { 
@@ -44,6 +49,15 @@ struct SpeechToTextModel {
         SIO_CHECK(config.nnet != "");
         SIO_INFO << "Loading torchscript nnet from: " << config.nnet; 
         nnet = torch::jit::load(config.nnet);
+        nnet.eval();
+        SetTorchThreads(config.scorer);
+
+        if (config.batch_scorer.max_batch_size > 1) {
+            SIO_CHECK(!batch_scorer);
+            SIO_INFO << "Batching nnet forward across sessions, max_batch_size: " << config.batch_scorer.max_batch_size;
+            batch_scorer = std::make_unique<BatchScorer>();
+            batch_scorer->Load(config.batch_scorer, nnet);
+        }
 
         if (config.graph != "") {
             SIO_INFO << "Loading decoding graph from: " << config.graph;
@@ -58,6 +72,18 @@ struct SpeechToTextModel {
         return Error::OK;
     }
 
+
+    // torch thread pools are process-wide, and inter-op threads can only be set before any inter-op work,
+    // so budgets of the first loaded model apply to the whole process.
+    static void SetTorchThreads(const ScorerConfig& config) {
+        static std::once_flag once;
+        std::call_once(once, [&config]() {
+            SIO_INFO << "torch intra-op threads: " << config.num_threads << ", inter-op threads: " << config.num_interop_threads;
+            torch::set_num_threads(config.num_threads);
+            torch::set_num_interop_threads(config.num_interop_threads);
+        });
+    }
+
 }; // class SpeechToTextModel
 }  // namespace sio
 
@@ -0,0 +1,240 @@
+#ifndef SIO_SPEECH_TO_TEXT_SERVER_H
+#define SIO_SPEECH_TO_TEXT_SERVER_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <deque>
+
+#include "sio/base.h"
+#include "sio/struct_loader.h"
+#include "sio/thread_pool.h"
+#include "sio/speech_to_text_model.h"
+#include "sio/speech_to_text.h"
+
+namespace sio {
+
+using SessionId = i64;
+
+struct SpeechToTextServerConfig {
+    // <= 0: hardware threads / scorer.num_threads,
+    // so that workers running nnet forwards concurrently don't oversubscribe cores
+    int num_workers = 0;
+
+    Error Register(StructLoader* loader, const std::string module = "") {
+        loader->AddEntry(module + ".num_workers", &num_workers);
+        return Error::OK;
+    }
+};
+
+
+/*
+ * SpeechToTextServer serves many concurrent sessions of one shared model with a fixed pool of worker threads:
+ *   1. model resources are loaded once & only read afterwards, see SpeechToTextModel.
+ *   2. requests of a session run one at a time in submission order, on any worker,
+ *      so a SpeechToText is only touched by one thread at a time, and idle sessions hold no thread.
+ *   3. a worker runs one request per turn then goes back to the FIFO pool queue, so sessions share workers fairly.
+ *   4. SpeechToText objects of closed sessions are reset & reused by later sessions.
+ * Sessions run in sync mode, i.e. the pool replaces per-session pipeline threads.
+ */
+class SpeechToTextServer {
+    struct Session {
+        Unique<SpeechToText*> stt;
+        std::mutex mutex;
+        std::deque<std::function<void()>> requests;
+        bool scheduled = false;  // a turn of this session is queued or running in pool
+    };
+
+    SpeechToTextServerConfig config_;
+    SpeechToTextModel model_;
+    Unique<ThreadPool*> pool_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    i64 num_scheduled_ = 0;  // sessions with a turn queued or running
+    FastMap<SessionId, std::shared_ptr<Session>> sessions_;
+    Vec<Unique<SpeechToText*>> idle_;
+    SessionId next_session_ = 0;
+    SearchStats stats_;  // of closed sessions
+    LatencyStats latency_;  // of closed sessions
+
+public:
+
+    Error Load(const SpeechToTextServerConfig& config, const Str& model_config_file) {
+        SIO_CHECK(!pool_); // Can't reload
+        config_ = config;
+
+        model_.Load(model_config_file);
+        SIO_CHECK(!model_.config.async); // server sessions run in sync mode on server workers
+
+        int hardware_threads = std::max<int>(std::thread::hardware_concurrency(), 1);
+        int intra_op_threads = std::max(model_.config.scorer.num_threads, 1);
+        int num_workers = config_.num_workers;
+        if (num_workers <= 0) {
+            num_workers = std::max(hardware_threads / intra_op_threads, 1);
+        }
+        if (num_workers * intra_op_threads > hardware_threads) {
+            SIO_WARNING << "Oversubscribed: " << num_workers << " workers x " << intra_op_threads
+                        << " intra-op threads > " << hardware_threads << " hardware threads";
+        }
+        SIO_INFO << "Starting " << num_workers << " server workers";
+
+        pool_ = std::make_unique<ThreadPool>(num_workers, []() {
+            at::init_num_threads(); // this worker's share of process-wide intra-op budget
+        });
+
+        return Error::OK;
+    }
+
+
+    // pending requests are completed first
+    ~SpeechToTextServer() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this]() { return num_scheduled_ == 0; });
+    }
+
+
+    SessionId Open() {
+        auto s = std::make_shared<Session>();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!idle_.empty()) {
+                s->stt = std::move(idle_.back());
+                idle_.pop_back();
+            }
+        }
+        if (!s->stt) {
+            s->stt = std::make_unique<SpeechToText>();
+            s->stt->Load(model_);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        SessionId id = next_session_++;
+        sessions_[id] = s;
+        return id;
+    }
+
+
+    // samples are queued to the session, future becomes ready once they are consumed
+    std::future<Error> Speech(SessionId id, Vec<f32> samples, f32 sample_rate) {
+        auto samples_ptr = std::make_shared<Vec<f32>>(std::move(samples));
+        return Post<Error>(Find(id), [samples_ptr, sample_rate](SpeechToText& stt) {
+            return stt.Speech(samples_ptr->data(), samples_ptr->size(), sample_rate);
+        });
+    }
+
+
+    // Ends the session with its final text, the session id is invalid afterwards
+    std::future<Str> Close(SessionId id) {
+        std::shared_ptr<Session> s = Find(id);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            sessions_.erase(id);
+        }
+
+        std::future<Str> result = Post<Str>(s, [this](SpeechToText& stt) {
+            stt.To();
+            Str text;
+            stt.Text(&text);
+
+            LatencyStats latency = stt.Latency();
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_.Merge(stt.Stats());
+            latency_.Merge(latency);
+            return text;
+        });
+
+        // SpeechToText is recycled by the last request of the session
+        Post<Error>(s, [this, s](SpeechToText& stt) {
+            stt.Reset();
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            idle_.push_back(std::move(s->stt)); // not touched by this session afterwards
+            return Error::OK;
+        });
+
+        return result;
+    }
+
+
+    // Search statistics of closed sessions
+    SearchStats Stats() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+
+    // Per-stage latency of closed sessions, e.g. Latency().ToJson() for export
+    LatencyStats Latency() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return latency_;
+    }
+
+
+    size_t NumWorkers() const {
+        return pool_->Size();
+    }
+
+
+    const SpeechToTextModel& Model() const {
+        return model_;
+    }
+
+private:
+
+    std::shared_ptr<Session> Find(SessionId id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = sessions_.find(id);
+        SIO_CHECK(it != sessions_.end()); // unknown or closed session
+        return it->second;
+    }
+
+
+    template <typename R>
+    std::future<R> Post(const std::shared_ptr<Session>& s, std::function<R(SpeechToText&)> request) {
+        auto task = std::make_shared<std::packaged_task<R()>>([s, request]() { return request(*s->stt); });
+        std::future<R> result = task->get_future();
+
+        std::lock_guard<std::mutex> lock(s->mutex);
+        s->requests.emplace_back([task]() { (*task)(); });
+        if (!s->scheduled) {
+            s->scheduled = true;
+            {
+                std::lock_guard<std::mutex> server_lock(mutex_);
+                num_scheduled_++;
+            }
+            pool_->Submit([this, s]() { Turn(s); });
+        }
+        return result;
+    }
+
+
+    // Runs one request of session s, & re-queues s if it has more
+    void Turn(const std::shared_ptr<Session>& s) {
+        std::function<void()> request;
+        {
+            std::lock_guard<std::mutex> lock(s->mutex);
+            request = std::move(s->requests.front());
+            s->requests.pop_front();
+        }
+
+        request();
+
+        std::lock_guard<std::mutex> lock(s->mutex);
+        if (!s->requests.empty()) {
+            pool_->Submit([this, s]() { Turn(s); });
+            return;
+        }
+        s->scheduled = false;
+
+        std::lock_guard<std::mutex> server_lock(mutex_);
+        if (--num_scheduled_ == 0) {
+            cond_.notify_all();
+        }
+    }
+
+}; // class SpeechToTextServer
+}  // namespace sio
+#endif
@@ -0,0 +1,118 @@
+#ifndef SIO_SPSC_QUEUE_H
+#define SIO_SPSC_QUEUE_H
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#include "sio/base.h"
+
+namespace sio {
+
+/*
+ * Bounded single-producer single-consumer queue, e.g. between two pipeline stages.
+ *   1. slots are a power-of-2 ring, head & tail are monotonic counters owned by consumer & producer respectively,
+ *      so TryPush() & TryPop() are lock-free.
+ *   2. blocking Push() & Pop() sleep on a condition variable when full & empty,
+ *      the other side only takes the mutex to wake them up if anyone is waiting.
+ */
+template <typename T>
+class SpscQueue {
+    Vec<T> slots_;
+    size_t mask_ = 0;
+
+    alignas(64) std::atomic<size_t> head_{0};  // next slot to pop
+    alignas(64) std::atomic<size_t> tail_{0};  // next slot to push
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::atomic<int> num_waiting_{0};
+
+public:
+
+    explicit SpscQueue(size_t capacity) {
+        SIO_CHECK_GT(capacity, 0);
+        size_t n = 1;
+        while (n < capacity) {
+            n *= 2;
+        }
+        slots_.resize(n);
+        mask_ = n - 1;
+    }
+
+
+    // producer only, x is untouched on failure
+    bool TryPush(T&& x) {
+        size_t t = tail_.load(std::memory_order_relaxed);
+        if (t - head_.load(std::memory_order_acquire) == slots_.size()) {
+            return false;
+        }
+        slots_[t & mask_] = std::move(x);
+        tail_.store(t + 1, std::memory_order_release);
+        Wake();
+        return true;
+    }
+
+
+    // consumer only
+    bool TryPop(T* x) {
+        size_t h = head_.load(std::memory_order_relaxed);
+        if (h == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        *x = std::move(slots_[h & mask_]);
+        head_.store(h + 1, std::memory_order_release);
+        Wake();
+        return true;
+    }
+
+
+    // producer only, blocks while full
+    void Push(T x) {
+        while (!TryPush(std::move(x))) {
+            Wait([this]() { return Size() < slots_.size(); });
+        }
+    }
+
+
+    // consumer only, blocks while empty
+    void Pop(T* x) {
+        while (!TryPop(x)) {
+            Wait([this]() { return Size() > 0; });
+        }
+    }
+
+
+    size_t Size() const {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+
+
+    size_t Capacity() const {
+        return slots_.size();
+    }
+
+private:
+
+    template <typename Pred>
+    void Wait(Pred ready) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        num_waiting_.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);  // pairs with the fence in Wake()
+        cond_.wait(lock, ready);
+        num_waiting_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+
+    // either the waiter sees the new head/tail, or this sees the waiter
+    void Wake() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (num_waiting_.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cond_.notify_all();
+        }
+    }
+
+}; // class SpscQueue
+} // namespace sio
+#endif
@@ -0,0 +1,54 @@
+#include "sio/spsc_queue.h"
+
+#include <thread>
+
+#include <gtest/gtest.h>
+
+namespace sio {
+
+TEST(SpscQueue, Basic) {
+    SpscQueue<int> q(3);
+    EXPECT_EQ(q.Capacity(), 4); // rounded up to power of 2
+
+    for (int i = 0; i != 4; i++) {
+        EXPECT_TRUE(q.TryPush(int(i)));
+    }
+    EXPECT_FALSE(q.TryPush(4));
+    EXPECT_EQ(q.Size(), 4);
+
+    int x = -1;
+    for (int i = 0; i != 4; i++) {
+        EXPECT_TRUE(q.TryPop(&x));
+        EXPECT_EQ(x, i);
+    }
+    EXPECT_FALSE(q.TryPop(&x));
+    EXPECT_EQ(q.Size(), 0);
+}
+
+
+TEST(SpscQueue, ProducerConsumer) {
+    const int n = 100000;
+    SpscQueue<Vec<int>> q(8); // small capacity, so both sides block often
+
+    std::thread producer([&]() {
+        for (int i = 0; i != n; i++) {
+            q.Push(Vec<int>(1 + i % 3, i));
+        }
+    });
+
+    i64 sum = 0;
+    bool in_order = true;
+    for (int i = 0; i != n; i++) {
+        Vec<int> v;
+        q.Pop(&v);
+        in_order = in_order && v.size() == 1 + i % 3 && v[0] == i;
+        sum += v[0];
+    }
+    producer.join();
+
+    EXPECT_TRUE(in_order);
+    EXPECT_EQ(sum, i64(n) * (n - 1) / 2);
+    EXPECT_EQ(q.Size(), 0);
+}
+
+} // namespace sio
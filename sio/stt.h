@@ -3,6 +3,7 @@
 
 #include "sio/base.h"
 #include "sio/linked_list.h"
+#include "sio/histogram.h"
 #include "sio/allocator.h"
 #include "sio/json.h"
 #include "sio/struct_loader.h"
@@ -15,9 +16,12 @@
 #include "sio/language_model.h"
 #include "sio/kenlm.h"
 #include "sio/search.h"
+#include "sio/batch_search.h"
+#include "sio/endpoint.h"
 #include "sio/speech_to_text_config.h"
 #include "sio/speech_to_text_model.h"
 #include "sio/speech_to_text.h"
+#include "sio/speech_to_text_server.h"
 
 #endif
 
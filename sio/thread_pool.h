@@ -0,0 +1,94 @@
+#ifndef SIO_THREAD_POOL_H
+#define SIO_THREAD_POOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <deque>
+
+#include "sio/base.h"
+
+namespace sio {
+
+/*
+ * Fixed-size pool of worker threads consuming a FIFO task queue.
+ * Tasks are started in submission order, pending tasks are still executed on destruction.
+ */
+class ThreadPool {
+    Vec<std::thread> threads_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<std::function<void()>> tasks_;
+    bool stop_ = false;
+
+public:
+
+    // on_thread_start runs first on each worker thread, e.g. per-thread initialization of libraries
+    explicit ThreadPool(int num_threads, std::function<void()> on_thread_start = nullptr) {
+        SIO_CHECK_GT(num_threads, 0);
+        for (int i = 0; i != num_threads; i++) {
+            threads_.emplace_back([this, on_thread_start]() {
+                if (on_thread_start) {
+                    on_thread_start();
+                }
+                WorkerLoop();
+            });
+        }
+    }
+
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cond_.notify_all();
+        for (std::thread& t : threads_) {
+            t.join();
+        }
+    }
+
+
+    // returned future becomes ready when task is done
+    template <typename F>
+    std::future<void> Submit(F&& task) {
+        auto packaged = std::make_shared<std::packaged_task<void()>>(std::forward<F>(task));
+        std::future<void> done = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            SIO_CHECK(!stop_);
+            tasks_.emplace_back([packaged]() { (*packaged)(); });
+        }
+        cond_.notify_one();
+        return done;
+    }
+
+
+    size_t Size() const {
+        return threads_.size();
+    }
+
+private:
+
+    void WorkerLoop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+                if (tasks_.empty()) {
+                    return; // stopped & drained
+                }
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+
+}; // class ThreadPool
+} // namespace sio
+#endif
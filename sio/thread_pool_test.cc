@@ -0,0 +1,58 @@
+#include "sio/thread_pool.h"
+
+#include <atomic>
+
+#include <gtest/gtest.h>
+
+namespace sio {
+
+TEST(ThreadPool, Basic) {
+    std::atomic<int> sum(0);
+    Vec<int> results(100, 0);
+    {
+        ThreadPool pool(4);
+        EXPECT_EQ(pool.Size(), 4);
+
+        Vec<std::future<void>> futures;
+        for (int i = 0; i != results.size(); i++) {
+            futures.push_back(pool.Submit([&, i]() {
+                results[i] = i * i;
+                sum += i;
+            }));
+        }
+        for (auto& f : futures) {
+            f.get();
+        }
+        EXPECT_EQ(sum, 4950);
+        for (int i = 0; i != results.size(); i++) {
+            EXPECT_EQ(results[i], i * i);
+        }
+
+        // pending tasks are drained on destruction
+        for (int i = 0; i != 100; i++) {
+            pool.Submit([&]() { sum += 1; });
+        }
+    }
+    EXPECT_EQ(sum, 5050);
+}
+
+
+TEST(ThreadPool, OnThreadStart) {
+    std::atomic<int> num_started(0);
+    thread_local bool started = false;
+    std::atomic<bool> all_started(true);
+    {
+        ThreadPool pool(3, [&]() { started = true; num_started++; });
+        Vec<std::future<void>> futures;
+        for (int i = 0; i != 30; i++) {
+            futures.push_back(pool.Submit([&]() { all_started = all_started && started; }));
+        }
+        for (auto& f : futures) {
+            f.get();
+        }
+    }
+    EXPECT_EQ(num_started, 3);
+    EXPECT_TRUE(all_started);
+}
+
+} // namespace sio
@@ -23,6 +23,12 @@ public:
     Error Load(const Str& tokenizer_vocab) {
         std::ifstream is(tokenizer_vocab);
         SIO_CHECK(is.good());
+        return Load(is);
+    }
+
+
+    // one "token prob" pair per line
+    Error Load(std::istream& is) {
         Str line;
         for (TokenId index = 0; std::getline(is, line); index++) {
             Vec<Str> cols = absl::StrSplit(line, absl::ByAnyChar(" \t"), absl::SkipWhitespace());
@@ -73,6 +79,23 @@ public:
         return token_to_index_.at(token);
     }
 
+
+    // blk, bos & eos, which are never recognized, e.g. the initial token of a search path outputs bos
+    bool IsSpecial(TokenId t) const {
+        return t == blk || t == bos || t == eos;
+    }
+
 }; // class Tokenizer
+
+
+// Whether a (partial) result has recognized anything
+inline bool HasRecognizedToken(const Vec<TokenId>& path, const Tokenizer& tokenizer) {
+    for (TokenId t : path) {
+        if (!tokenizer.IsSpecial(t)) {
+            return true;
+        }
+    }
+    return false;
+}
 }  // namespace sio
 #endif
@@ -1,47 +1,130 @@
 #include <assert.h>
+#include <stdlib.h>
 #include <limits>
 #include <string>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <vector>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
 
 #include "sio/stt.h"
 
-int main() {
+// Results are written in input order as soon as all preceding utterances are done
+struct OrderedWriter {
+    std::mutex mutex;
+    std::vector<std::string> lines;
+    std::vector<bool> done;
+    size_t next = 0;
+
+    explicit OrderedWriter(size_t n) : lines(n), done(n, false) { }
+
+    void Write(size_t k, std::string line) {
+        std::lock_guard<std::mutex> lock(mutex);
+        lines[k] = std::move(line);
+        done[k] = true;
+        for (; next != done.size() && done[next]; next++) {
+            std::cout << lines[next];
+            lines[next].clear();
+        }
+        std::cout.flush();
+    }
+};
+
+
+// Usage: stt [num_threads=1] [latency.json]
+//   utterances of wav.list are sharded across num_threads sessions sharing one model,
+//   per-stage latency of all sessions is optionally exported as json
+int main(int argc, char* argv[]) {
+    int num_threads = argc > 1 ? atoi(argv[1]) : 1;
+    const char* latency_json = argc > 2 ? argv[2] : nullptr;
+    assert(num_threads > 0);
+
     sio::SpeechToTextModel model;
     model.Load("stt.json");
 
-    sio::SpeechToText stt;
-    stt.Load(model);
-
     size_t samples_per_chunk = model.config.online ? 1000 : std::numeric_limits<size_t>::max();
 
+    std::vector<std::string> audios;
     std::ifstream audio_list("wav.list");
     std::string audio;
-    int num_utts = 0;
-
     while (std::getline(audio_list, audio)) {
-        std::vector<float> samples;
-        float sample_rate;
-        sio::ReadAudio(audio, &samples, &sample_rate);
-        assert(sample_rate == 16000.0);
-
-        size_t offset = 0;
-        while (offset < samples.size()) {
-            size_t n = std::min(samples_per_chunk, samples.size() - offset);
-            stt.Speech(&samples[offset], n, sample_rate);
-            offset += n;
-        }
+        audios.push_back(audio);
+    }
 
-        stt.To();
+    OrderedWriter writer(audios.size());
+    std::atomic<size_t> next_utt(0);
 
-        std::string text;
-        stt.Text(&text);
+    std::mutex stats_mutex;
+    sio::SearchStats stats;
+    sio::LatencyStats latency;
+    sio::Histogram latency_ms = sio::Histogram::Exponential(1.0, 1.25, 64);  // per utterance, audio read + decode
+    double total_audio_seconds = 0.0;
 
-        std::cout << ++num_utts << "\t" << audio << "\t" << offset/sample_rate << "\t" << text << "\n";
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i != num_threads; i++) {
+        threads.emplace_back([&]() {
+            at::init_num_threads();  // this thread's share of process-wide intra-op budget
+
+            sio::SpeechToText stt;
+            stt.Load(model);
+
+            for (size_t k = next_utt++; k < audios.size(); k = next_utt++) {
+                auto utt_begin = std::chrono::steady_clock::now();
+
+                std::vector<float> samples;
+                float sample_rate;
+                sio::ReadAudio(audios[k], &samples, &sample_rate);
+                assert(sample_rate == 16000.0);
+
+                size_t offset = 0;
+                while (offset < samples.size() && !stt.Endpointed()) {
+                    size_t n = std::min(samples_per_chunk, samples.size() - offset);
+                    stt.Speech(&samples[offset], n, sample_rate);
+                    offset += n;
+                }
+
+                stt.To();
+
+                std::string text;
+                stt.Text(&text);
+
+                std::ostringstream line;
+                line << k + 1 << "\t" << audios[k] << "\t" << offset/sample_rate << "\t" << text << "\n";
+                writer.Write(k, line.str());
+
+                {
+                    std::lock_guard<std::mutex> lock(stats_mutex);
+                    stats.Merge(stt.Stats());
+                    latency.Merge(stt.Latency());
+                    latency_ms.Add(std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - utt_begin).count());
+                    total_audio_seconds += samples.size() / sample_rate;
+                }
+                stt.Reset();
+            }
+        });
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
 
-        stt.Reset();
+    SIO_INFO << "Search stats:\n" << stats.Report();
+    SIO_INFO << "Latency stats:\n" << latency.Report();
+    if (latency_json != nullptr) {
+        std::ofstream(latency_json) << latency.ToJson().dump(2) << "\n";
     }
+    SIO_INFO << absl::StrFormat(
+        "threads:%d utts:%d audio:%.1fs wall:%.1fs RTF:%.4f throughput:%.1fx realtime, %.2f utts/s\n"
+        "  utterance latency(ms) mean:%.1f p50:%.1f p90:%.1f p99:%.1f max:%.1f",
+        num_threads, audios.size(), total_audio_seconds, elapsed,
+        elapsed / std::max(total_audio_seconds, 1e-9), total_audio_seconds / std::max(elapsed, 1e-9), audios.size() / std::max(elapsed, 1e-9),
+        latency_ms.Mean(), latency_ms.Quantile(0.5), latency_ms.Quantile(0.9), latency_ms.Quantile(0.99), latency_ms.Max()
+    );
 
     return 0;
 }